@@ -3,31 +3,283 @@
 #include <cstdlib>
 #include <ctime>
 #include <cmath>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <tuple>
 #include <SDL2/SDL.h>
 #include <omp.h>
+#include "telemetry.h"
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <cstdint>
+#include <iomanip>
+#include <iterator>
 
 
 const int SCREEN_WIDTH = 640;
 const int SCREEN_HEIGHT = 480;
 
-struct Entity
+// Tamaño de los tiles usados para llevar la cuenta de las regiones sucias
+const int DIRTY_TILE = 32;
+const int DIRTY_COLS = (SCREEN_WIDTH + DIRTY_TILE - 1) / DIRTY_TILE;
+const int DIRTY_ROWS = (SCREEN_HEIGHT + DIRTY_TILE - 1) / DIRTY_TILE;
+// Con más rectángulos que esto sale más barato redibujar toda la pantalla
+const int MAX_DIRTY_RECTS = 48;
+
+// Radio máximo que genera init()
+const int MAX_RADIUS = 29;
+// Margen con el que se engordan los círculos en la fase amplia. Mientras ninguna
+// entidad se aleje más de la mitad de su ancla, la lista de pares cercanos sigue
+// conteniendo todos los contactos posibles
+const int CONTACT_MARGIN = 24;
+// Tamaño de las celdas de la grilla de la fase amplia
+const int GRID_CELL = 32;
+const int GRID_COLS = (SCREEN_WIDTH + GRID_CELL - 1) / GRID_CELL;
+const int GRID_ROWS = (SCREEN_HEIGHT + GRID_CELL - 1) / GRID_CELL;
+// Frames seguidos sin velocidad ni contactos para que una entidad se duerma
+const int SLEEP_FRAMES = 30;
+// Frames que se mide cada configuración candidata y frames que se usa la mejor
+// antes de volver a medir
+const int EXPLORE_FRAMES = 8;
+const int EXPLOIT_FRAMES = 300;
+// Dirección (--ai): un Pacman persigue al fantasma visible más cercano dentro
+// de PURSUIT_RADIUS y un fantasma huye de los Pacman dentro de FLEE_RADIUS
+const int PURSUIT_RADIUS = 160;
+const int FLEE_RADIUS = 80;
+// Cada cuántos frames la telemetría recuenta los pares vigentes en la cola del
+// modo cinético, que cuesta recorrerla entera
+const int KINETIC_PAIRS_EVERY = 64;
+
+// Cada tipo de entidad vive en su propio arreglo con solo los campos que usa.
+// Los campos de movimiento tienen los mismos nombres en los dos tipos, así el
+// movimiento y las colisiones son plantillas que se especializan por tipo
+struct Pacman
 {
     int x, y;
     int radius;
     int xVel, yVel;
-    Uint8 r, g, b;
-    bool isPacman;
     float mouthOpen;
     bool mouthClosing;
-    float eyeOffset;
+};
+
+struct Ghost
+{
+    int x, y;
+    int radius;
+    int xVel, yVel;
+    Uint8 r, g, b;
     bool eyeMovingRight;
     bool isVisible;
+    float eyeOffset;
     Uint32 invisibleTime;
 };
 
-std::vector<Entity> entities;
+// Formato compacto (--compact) para escenas enormes: 8 bytes por Pacman y 12
+// por fantasma. Las posiciones ya son pixeles enteros, así que 16 bits alcanzan
+// sin perder nada; la boca va en centésimas y los ojos en décimas, que son los
+// pasos de la animación, y el color es un índice en la paleta fija 3-3-2. El
+// movimiento y las colisiones trabajan directo sobre estos campos; lo demás
+// desempaqueta a la forma completa en registros y vuelve a empaquetar
+struct CompactPacman
+{
+    int16_t x, y;
+    int8_t xVel, yVel;
+    uint8_t radius;
+    uint8_t mouthOpen : 7; // Centésimas
+    uint8_t mouthClosing : 1;
+};
+
+struct CompactGhost
+{
+    int16_t x, y;
+    int8_t xVel, yVel;
+    uint8_t radius;
+    uint8_t color;  // RRRGGGBB
+    int8_t eyeOffset; // Décimas
+    uint8_t eyeMovingRight : 1;
+    uint8_t isVisible : 1;
+    uint16_t invisibleTime; // Milisegundos módulo 65536, alcanza para los 2 segundos
+};
+
+static_assert(sizeof(CompactPacman) == 8 && sizeof(CompactGhost) == 12, "compact entities must stay packed");
+
+Pacman unpack(const CompactPacman &c)
+{
+    return Pacman{c.x, c.y, c.radius, c.xVel, c.yVel, c.mouthOpen / 100.0f, c.mouthClosing != 0};
+}
+
+Ghost unpack(const CompactGhost &c)
+{
+    Ghost g;
+    g.x = c.x;
+    g.y = c.y;
+    g.radius = c.radius;
+    g.xVel = c.xVel;
+    g.yVel = c.yVel;
+    g.r = (c.color >> 5) * 255 / 7;
+    g.g = ((c.color >> 2) & 7) * 255 / 7;
+    g.b = (c.color & 3) * 255 / 3;
+    g.eyeMovingRight = c.eyeMovingRight;
+    g.isVisible = c.isVisible;
+    g.eyeOffset = c.eyeOffset / 10.0f;
+    g.invisibleTime = c.invisibleTime;
+    return g;
+}
+
+void pack(const Pacman &p, Pacman &out)
+{
+    out = p;
+}
+
+void pack(const Ghost &g, Ghost &out)
+{
+    out = g;
+}
+
+void pack(const Pacman &p, CompactPacman &out)
+{
+    out.x = p.x;
+    out.y = p.y;
+    out.xVel = p.xVel;
+    out.yVel = p.yVel;
+    out.radius = p.radius;
+    out.mouthOpen = std::lround(p.mouthOpen * 100);
+    out.mouthClosing = p.mouthClosing;
+}
+
+void pack(const Ghost &g, CompactGhost &out)
+{
+    out.x = g.x;
+    out.y = g.y;
+    out.xVel = g.xVel;
+    out.yVel = g.yVel;
+    out.radius = g.radius;
+    out.color = (g.r >> 5) << 5 | (g.g >> 5) << 2 | g.b >> 6;
+    out.eyeOffset = std::lround(g.eyeOffset * 10);
+    out.eyeMovingRight = g.eyeMovingRight;
+    out.isVisible = g.isVisible;
+    out.invisibleTime = g.invisibleTime;
+}
+
+// Lo que se dibujó de cada entidad. Va aparte para no arrastrarlo por los
+// ciclos de la simulación
+struct DrawRecord
+{
+    SDL_Rect drawnBounds; // Donde se dibujó en el último frame (w == 0 si nunca)
+    SDL_Rect damage;      // Región a limpiar y redibujar en este frame
+    Uint32 drawnColor;    // Color RGB con que se dibujó, si se dibujó como punto
+};
+
+// Arreglo de un tipo de entidad reservado con mmap. Las páginas no se tocan al
+// reservar, así cada hilo las toca primero y quedan en el nodo NUMA del hilo
+// que las usa. También puede apuntar dentro del mapeo de un checkpoint
+template <typename T>
+struct ArchetypeBuffer
+{
+    T *data = nullptr;
+    int count = 0;
+    void *mapping = nullptr; // Región propia que hay que liberar (nullptr si es prestada)
+    size_t bytes = 0;
+
+    bool allocate(int n)
+    {
+        bytes = std::max<size_t>(sizeof(T) * n, 1);
+        void *memory = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            return false;
+        }
+        mapping = memory;
+        data = static_cast<T *>(memory);
+        count = n;
+        return true;
+    }
+
+    // Usa como almacenamiento memoria ya mapeada por otro, sin copiar nada
+    void adopt(void *memory, int n)
+    {
+        mapping = nullptr;
+        data = static_cast<T *>(memory);
+        count = n;
+    }
+
+    void release()
+    {
+        if (mapping != nullptr)
+        {
+            munmap(mapping, bytes);
+        }
+        mapping = nullptr;
+        data = nullptr;
+        count = 0;
+    }
+
+    int size() const { return count; }
+    T &operator[](int i) { return data[i]; }
+    const T &operator[](int i) const { return data[i]; }
+};
+
+struct CpuInfo
+{
+    int cpu;
+    int node;
+    int package;
+    int core;
+    int sibling; // Posición entre los hilos de hardware del mismo núcleo
+};
+
+// Política para fijar los hilos de OpenMP a CPUs
+enum PinPolicy
+{
+    PIN_NONE,    // Lo decide el runtime (o OMP_PROC_BIND)
+    PIN_COMPACT, // Hilos consecutivos en CPUs vecinas, llenando un nodo antes del siguiente
+    PIN_SCATTER, // Hilos repartidos en round-robin entre nodos NUMA
+    PIN_LIST     // Lista explícita de CPUs
+};
+
+struct Options
+{
+    int numPacmans = 0;
+    int numGhosts = 0;
+    int numThreads = 0;
+    PinPolicy pin = PIN_NONE;
+    std::vector<int> pinCpus;
+    bool perf = false;
+    uint64_t seed = 0;
+    bool hasSeed = false;
+    int lodRadius = 0;          // Entidades con radio menor se dibujan como un punto
+    int heatmapCount = 100000;  // Desde esta cantidad se dibuja un mapa de densidad
+    std::string savePath;       // Checkpoint que se escribe al salir (y cada checkpointEvery frames)
+    std::string restorePath;
+    int checkpointEvery = 0;
+    bool adaptive = true;       // Elegir hilos y chunk por fase según el tiempo medido
+    std::string telemetryName;  // Segmento shm donde se publican los contadores
+    bool compact = false;       // Entidades en el formato compacto
+    bool steering = false;      // Persecución y huida en vez de movimiento balístico
+    std::string mazePath;       // Laberinto con paredes; los fantasmas van hacia los Pacman
+    int batchCount = 0;         // Escenas del modo por lotes con las cantidades de la línea de comandos
+    std::string batchPath;      // O un archivo con una escena por línea
+    int batchFrames = 1000;     // Pasos que se simula cada escena del lote
+    bool kinetic = false;       // Simulación por eventos en vez de paso fijo
+
+    bool batch() const { return batchCount > 0 || !batchPath.empty(); }
+};
+
+Options options;
 
-bool checkCollision(Entity &a, Entity &b)
+template <typename A, typename B>
+bool checkCollision(const A &a, const B &b)
 {
     int dx = a.x - b.x;
     int dy = a.y - b.y;
@@ -36,10 +288,15 @@ bool checkCollision(Entity &a, Entity &b)
     return distance < a.radius + b.radius;
 }
 
-void resolveCollision(Entity &a, Entity &b)
+template <typename A, typename B>
+void resolveCollision(A &a, B &b)
 {
     int dx = b.x - a.x;
     int dy = b.y - a.y;
+    if (dx == 0 && dy == 0)
+    {
+        dx = 1; // Centros iguales: se separan en x para no dividir por cero
+    }
     float distance = sqrt(dx * dx + dy * dy);
     float overlap = a.radius + b.radius - distance;
 
@@ -58,267 +315,3624 @@ void resolveCollision(Entity &a, Entity &b)
     std::swap(a.yVel, b.yVel);
 }
 
-bool init(int numEntities, int numGhosts)
+// Caja que cubren los ojos de un fantasma, para cualquier valor de eyeOffset.
+// eyeOffset se pasa hasta ±5.1 antes de dar la vuelta y drawEntity trunca,
+// así que el borde del ojo izquierdo llega a x - 14
+SDL_Rect eyeBounds(const Ghost &ghost)
 {
-    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    return SDL_Rect{ghost.x - 14, ghost.y - 8, 29, 7};
+}
+
+// Las entidades chicas se dibujan como un cuadradito del tamaño de un punto
+template <typename T>
+bool drawnAsPoint(const T &entity)
+{
+    return entity.radius < options.lodRadius;
+}
+
+template <typename T>
+SDL_Rect pointBounds(const T &entity)
+{
+    return SDL_Rect{entity.x - 1, entity.y - 1, 2, 2};
+}
+
+template <typename T>
+SDL_Rect bodyBounds(const T &entity)
+{
+    return SDL_Rect{entity.x - entity.radius, entity.y - entity.radius, 2 * entity.radius + 1, 2 * entity.radius + 1};
+}
+
+// Caja que cubre todo lo que se dibuja de una entidad en su estado actual
+SDL_Rect entityBounds(const Pacman &pacman)
+{
+    return drawnAsPoint(pacman) ? pointBounds(pacman) : bodyBounds(pacman);
+}
+
+SDL_Rect entityBounds(const Ghost &ghost)
+{
+    if (drawnAsPoint(ghost))
     {
-        std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
-        return false;
+        return pointBounds(ghost);
+    }
+    SDL_Rect body = bodyBounds(ghost);
+    SDL_Rect eyes = eyeBounds(ghost);
+    if (!ghost.isVisible)
+    {
+        return eyes;
     }
+    SDL_Rect bounds;
+    SDL_UnionRect(&body, &eyes, &bounds);
+    return bounds;
+}
+
+// Parte que cambia de un frame a otro aunque la entidad no se mueva
+SDL_Rect animatedBounds(const Pacman &pacman)
+{
+    return bodyBounds(pacman); // La boca se abre y se cierra en cada frame
+}
 
-    srand(time(NULL));
+SDL_Rect animatedBounds(const Ghost &ghost)
+{
+    return eyeBounds(ghost); // Solo se mueven los ojos
+}
 
-    for (int i = 0; i < numEntities; ++i)
+// Calcula la región dañada por una entidad: la caja vieja y la nueva si se movió
+// o cambió de forma, o solo la parte animada si se quedó quieta
+template <typename T>
+void trackDamage(const T &entity, DrawRecord &record)
+{
+    SDL_Rect bounds = entityBounds(entity);
+    Uint8 r = 0, g = 0, b = 0;
+    if (drawnAsPoint(entity))
     {
-        Entity e;
-        e.radius = rand() % 20 + 10;
-        e.x = rand() % (SCREEN_WIDTH - 2 * e.radius) + e.radius;
-        e.y = rand() % (SCREEN_HEIGHT - 2 * e.radius) + e.radius;
-        e.xVel = rand() % 5 + 1;
-        e.yVel = rand() % 5 + 1;
-        e.r = 255;
-        e.g = 255;
-        e.b = 0;
-        e.isPacman = true;
-        e.mouthOpen = 0.1;
-        e.mouthClosing = true;
-        entities.push_back(e);
+        pointColor(entity, r, g, b);
     }
-
-    for (int i = 0; i < numGhosts; ++i)
+    Uint32 color = (r << 16) | (g << 8) | b;
+    if (record.drawnBounds.w == 0)
     {
-        Entity e;
-        e.radius = rand() % 20 + 10;
-        e.x = rand() % (SCREEN_WIDTH - 2 * e.radius) + e.radius;
-        e.y = rand() % (SCREEN_HEIGHT - 2 * e.radius) + e.radius;
-        e.xVel = rand() % 2;
-        e.yVel = rand() % 2;
-        e.r = rand() % 256;
-        e.g = rand() % 256;
-        e.b = rand() % 256;
-        e.isPacman = false;
-
-        e.eyeOffset = 0;
-        e.eyeMovingRight = true;
-        e.isVisible = true;
-        e.invisibleTime = 0;
-        entities.push_back(e);
+        record.damage = bounds;
     }
-
-    return true;
+    else if (!SDL_RectEquals(&bounds, &record.drawnBounds))
+    {
+        SDL_UnionRect(&bounds, &record.drawnBounds, &record.damage);
+    }
+    else if (drawnAsPoint(entity))
+    {
+        // Un punto quieto solo cambia de color: un fantasma comido se ve blanco
+        // hasta que reaparece
+        record.damage = color != record.drawnColor ? bounds : SDL_Rect{0, 0, 0, 0};
+    }
+    else
+    {
+        record.damage = animatedBounds(entity);
+    }
+    record.drawnBounds = bounds;
+    record.drawnColor = color;
 }
 
-void close()
+// Marca en la grilla de tiles los tiles que toca un rectángulo
+void markDirty(bool dirtyTiles[DIRTY_ROWS][DIRTY_COLS], const SDL_Rect &rect)
 {
-    SDL_Quit();
+    if (rect.w <= 0 || rect.h <= 0)
+    {
+        return;
+    }
+    int c0 = std::max(rect.x, 0) / DIRTY_TILE;
+    int r0 = std::max(rect.y, 0) / DIRTY_TILE;
+    int c1 = std::min(rect.x + rect.w - 1, SCREEN_WIDTH - 1) / DIRTY_TILE;
+    int r1 = std::min(rect.y + rect.h - 1, SCREEN_HEIGHT - 1) / DIRTY_TILE;
+    for (int row = r0; row <= r1; ++row)
+    {
+        for (int col = c0; col <= c1; ++col)
+        {
+            dirtyTiles[row][col] = true;
+        }
+    }
 }
 
-int main(int argc, char *args[])
+// Junta los tiles sucios en rectángulos: corridas horizontales por fila, y las
+// corridas iguales de filas consecutivas se unen en un solo rectángulo
+void buildDirtyRects(bool dirtyTiles[DIRTY_ROWS][DIRTY_COLS], std::vector<SDL_Rect> &rects)
 {
-    if (argc != 3)
+    rects.clear();
+    std::vector<size_t> open, stillOpen; // Rectángulos que llegan hasta la fila anterior
+    for (int row = 0; row < DIRTY_ROWS; ++row)
     {
-        std::cerr << "Usage: " << args[0] << " <numPacmans> <numGhosts>" << std::endl;
-        return 1;
+        stillOpen.clear();
+        for (int col = 0; col < DIRTY_COLS; ++col)
+        {
+            if (!dirtyTiles[row][col])
+            {
+                continue;
+            }
+            int start = col;
+            while (col < DIRTY_COLS && dirtyTiles[row][col])
+            {
+                col++;
+            }
+            SDL_Rect run{start * DIRTY_TILE, row * DIRTY_TILE, (col - start) * DIRTY_TILE, DIRTY_TILE};
+
+            size_t k = 0;
+            while (k < open.size() && (rects[open[k]].x != run.x || rects[open[k]].w != run.w))
+            {
+                k++;
+            }
+            if (k < open.size())
+            {
+                rects[open[k]].h += DIRTY_TILE;
+                stillOpen.push_back(open[k]);
+            }
+            else
+            {
+                stillOpen.push_back(rects.size());
+                rects.push_back(run);
+            }
+        }
+        open.swap(stillOpen);
     }
 
-    int numPacmans = std::atoi(args[1]);
-    int numGhosts = std::atoi(args[2]);
+    for (SDL_Rect &rect : rects)
+    {
+        rect.w = std::min(rect.w, SCREEN_WIDTH - rect.x);
+        rect.h = std::min(rect.h, SCREEN_HEIGHT - rect.y);
+    }
+}
 
-    if (!init(numPacmans, numGhosts))
+void animateEntity(Pacman &pacman)
+{
+    if (pacman.mouthClosing)
     {
-        return 1;
+        pacman.mouthOpen += 0.01;
+        if (pacman.mouthOpen >= 0.3)
+            pacman.mouthClosing = false;
+    }
+    else
+    {
+        pacman.mouthOpen -= 0.01;
+        if (pacman.mouthOpen <= 0.05)
+            pacman.mouthClosing = true;
     }
+}
 
-    SDL_Window *window = SDL_CreateWindow("Pacman and Ghosts Screensaver", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
-    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+void animateEntity(Ghost &ghost)
+{
+    // Mover los ojos
+    if (ghost.eyeMovingRight)
+    {
+        ghost.eyeOffset += 0.1;
+        if (ghost.eyeOffset >= 5)
+            ghost.eyeMovingRight = false;
+    }
+    else
+    {
+        ghost.eyeOffset -= 0.1;
+        if (ghost.eyeOffset <= -5)
+            ghost.eyeMovingRight = true;
+    }
+}
 
-    bool quit = false;
-    SDL_Event e;
-    int lowLimit = 0;
-    int realLimit = 0;
+// Color con el que se ve una entidad desde lejos: un fantasma invisible solo
+// deja ver los ojos
+void pointColor(const Pacman &, Uint8 &r, Uint8 &g, Uint8 &b)
+{
+    r = 255;
+    g = 255;
+    b = 0;
+}
 
-    Uint32 startTime = SDL_GetTicks();
-    Uint32 frameCount = 0;
+void pointColor(const Ghost &ghost, Uint8 &r, Uint8 &g, Uint8 &b)
+{
+    r = ghost.isVisible ? ghost.r : 255;
+    g = ghost.isVisible ? ghost.g : 255;
+    b = ghost.isVisible ? ghost.b : 255;
+}
 
+template <typename T>
+void drawPoint(SDL_Renderer *renderer, const T &entity)
+{
+    Uint8 r, g, b;
+    pointColor(entity, r, g, b);
+    SDL_SetRenderDrawColor(renderer, r, g, b, 255);
+    SDL_Rect quad = pointBounds(entity);
+    SDL_RenderFillRect(renderer, &quad);
+}
 
+void drawEntity(SDL_Renderer *renderer, const Pacman &pacman)
+{
+    if (drawnAsPoint(pacman))
+    {
+        drawPoint(renderer, pacman);
+        return;
+    }
 
-    while (!quit)
+    // Draw Pacman as a filled circle with a mouth
+    SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
+    for (float angle = pacman.mouthOpen * M_PI; angle <= 2 * M_PI - pacman.mouthOpen * M_PI; angle += 0.01)
     {
-        lowLimit++;
-        if (lowLimit % 100 == 0)
+        for (int r = 0; r < pacman.radius; ++r)
         {
-            realLimit++;
+            int x = pacman.x + r * cos(angle);
+            int y = pacman.y + r * sin(angle);
+            SDL_RenderDrawPoint(renderer, x, y);
         }
-        while (SDL_PollEvent(&e) != 0)
+    }
+}
+
+void drawEntity(SDL_Renderer *renderer, const Ghost &ghost)
+{
+    if (drawnAsPoint(ghost))
+    {
+        drawPoint(renderer, ghost);
+        return;
+    }
+
+    // Draw Ghost as an outlined circle
+    if (ghost.isVisible)
+    {
+        SDL_SetRenderDrawColor(renderer, ghost.r, ghost.g, ghost.b, 255);
+        for (float angle = 0; angle <= 2 * M_PI; angle += 0.01)
         {
-            if (e.type == SDL_QUIT)
-            {
-                quit = true;
-            }
+            int x = ghost.x + ghost.radius * cos(angle);
+            int y = ghost.y + ghost.radius * sin(angle);
+            SDL_RenderDrawPoint(renderer, x, y);
         }
-        int limit = std::min(realLimit, static_cast<int>(entities.size())); // Obtén el menor entre 10 y el tamaño del vector
-
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
-        Uint32 currentTime = SDL_GetTicks();
+    }
 
-        // definimos que solo se abra un thread por elemento
-        omp_set_num_threads(entities.size());
+    // Dibujar ojos del fantasma
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    int eyeRadius = 3; // Radio del ojo
 
-        // Handle collisions and drawing
-        #pragma omp parallel for
-        for (int i = 0; i < limit; ++i)
+    for (int eye = 0; eye < 2; ++eye)
+    {
+        int eyeX = ghost.x + (eye == 0 ? -5 : 5) + ghost.eyeOffset;
+        int eyeY = ghost.y - 5;
+        for (float angle = 0; angle <= 2 * M_PI; angle += 0.01)
         {
-            Entity &entity = entities[i];
-            for (int j = 0; j < limit; ++j)
-            {
-                Entity &other = entities[j];
-                if (&entity != &other && checkCollision(entity, other))
-                {
-                        if (entity.isPacman && !other.isPacman && other.isVisible)
-                        {
-                            #pragma omp atomic write
-                            other.isVisible = false;
-                            #pragma omp atomic write
-                            other.invisibleTime = currentTime;
-                        }
-                        if (!entity.isPacman && other.isPacman && entity.isVisible)
-                        {
-                            #pragma omp atomic write
-                            entity.isVisible = false;
-                            #pragma omp atomic write
-                            entity.invisibleTime = currentTime;
-                        }
-                        resolveCollision(entity, other);
-                }
-                if (&entity != &entity && checkCollision(entity, entity))
-                {
-                    resolveCollision(entity, other);
-                }
-            }
+            int x = eyeX + eyeRadius * cos(angle);
+            int y = eyeY + eyeRadius * sin(angle);
+            SDL_RenderDrawPoint(renderer, x, y);
+        }
+    }
+}
 
-            entity.x += entity.xVel;
-            entity.y += entity.yVel;
+// El formato compacto usa las mismas rutinas sobre la entidad desempaquetada
+SDL_Rect entityBounds(const CompactPacman &pacman) { return entityBounds(unpack(pacman)); }
+SDL_Rect entityBounds(const CompactGhost &ghost) { return entityBounds(unpack(ghost)); }
+SDL_Rect animatedBounds(const CompactPacman &pacman) { return animatedBounds(unpack(pacman)); }
+SDL_Rect animatedBounds(const CompactGhost &ghost) { return animatedBounds(unpack(ghost)); }
+void pointColor(const CompactPacman &pacman, Uint8 &r, Uint8 &g, Uint8 &b) { pointColor(unpack(pacman), r, g, b); }
+void pointColor(const CompactGhost &ghost, Uint8 &r, Uint8 &g, Uint8 &b) { pointColor(unpack(ghost), r, g, b); }
+void drawEntity(SDL_Renderer *renderer, const CompactPacman &pacman) { drawEntity(renderer, unpack(pacman)); }
+void drawEntity(SDL_Renderer *renderer, const CompactGhost &ghost) { drawEntity(renderer, unpack(ghost)); }
 
-            if (entity.x - entity.radius < 0)
-            {
-                entity.x = entity.radius;
-                entity.xVel = -entity.xVel;
-            }
-            else if (entity.x + entity.radius > SCREEN_WIDTH)
-            {
-                entity.x = SCREEN_WIDTH - entity.radius;
-                entity.xVel = -entity.xVel;
-            }
+template <typename Compact>
+void animateCompact(Compact &compact)
+{
+    auto entity = unpack(compact);
+    animateEntity(entity);
+    pack(entity, compact);
+}
 
-            if (entity.y - entity.radius < 0)
-            {
-                entity.y = entity.radius;
-                entity.yVel = -entity.yVel;
-            }
-            else if (entity.y + entity.radius > SCREEN_HEIGHT)
-            {
-                entity.y = SCREEN_HEIGHT - entity.radius;
-                entity.yVel = -entity.yVel;
-            }
-            #pragma omp critical
-            {
-            SDL_SetRenderDrawColor(renderer, entity.r, entity.g, entity.b, 255);
-            if (entity.isPacman)
-            {
-                // Draw Pacman as a filled circle with a mouth
-                for (float angle = entity.mouthOpen * M_PI; angle <= 2 * M_PI - entity.mouthOpen * M_PI; angle += 0.01)
-                {
-                    for (int r = 0; r < entity.radius; ++r)
-                    {
-                        int x = entity.x + r * cos(angle);
-                        int y = entity.y + r * sin(angle);
-                        SDL_RenderDrawPoint(renderer, x, y);
-                    }
-                }
+void animateEntity(CompactPacman &pacman) { animateCompact(pacman); }
+void animateEntity(CompactGhost &ghost) { animateCompact(ghost); }
 
-                if (entity.mouthClosing)
-                {
-                    entity.mouthOpen += 0.01;
-                    if (entity.mouthOpen >= 0.3)
-                        entity.mouthClosing = false;
-                }
-                else
-                {
-                    entity.mouthOpen -= 0.01;
-                    if (entity.mouthOpen <= 0.05)
-                        entity.mouthClosing = true;
-                }
-            }
-            else
-            {
-                // Draw Ghost as an outlined circle
-                if (entity.isVisible)
-                {
-                    for (float angle = 0; angle <= 2 * M_PI; angle += 0.01)
-                    {
-                        int x = entity.x + entity.radius * cos(angle);
-                        int y = entity.y + entity.radius * sin(angle);
-                        SDL_RenderDrawPoint(renderer, x, y);
-                    }
-                }
+// Interpreta listas de CPUs con el formato de sysfs: "0-3,8,10-11"
+bool parseCpuList(const std::string &text, std::vector<int> &cpus)
+{
+    cpus.clear();
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos)
+        {
+            end = text.size();
+        }
+        std::string item = text.substr(pos, end - pos);
+        pos = end + 1;
+        if (item.empty() || item == "\n")
+        {
+            continue;
+        }
 
-                // Dibujar ojos del fantasma
-                SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-                int eyeRadius = 3; // Radio del ojo
+        char *rest;
+        long first = std::strtol(item.c_str(), &rest, 10);
+        long last = first;
+        if (*rest == '-')
+        {
+            last = std::strtol(rest + 1, &rest, 10);
+        }
+        if (rest == item.c_str() || (*rest != '\0' && *rest != '\n') || first < 0 || last < first)
+        {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; ++cpu)
+        {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+    return !cpus.empty();
+}
 
-                for (int eye = 0; eye < 2; ++eye)
-                {
-                    int eyeX = entity.x + (eye == 0 ? -5 : 5) + entity.eyeOffset;
-                    int eyeY = entity.y - 5;
-                    for (float angle = 0; angle <= 2 * M_PI; angle += 0.01)
-                    {
-                        int x = eyeX + eyeRadius * cos(angle);
-                        int y = eyeY + eyeRadius * sin(angle);
-                        SDL_RenderDrawPoint(renderer, x, y);
-                    }
-                }
+int readSysfsInt(const std::string &path, int fallback)
+{
+    std::ifstream file(path);
+    int value;
+    return (file >> value) ? value : fallback;
+}
 
-                // Mover los ojos
-                if (entity.eyeMovingRight)
-                {
-                    entity.eyeOffset += 0.1;
-                    if (entity.eyeOffset >= 5)
-                        entity.eyeMovingRight = false;
-                }
-                else
-                {
-                    entity.eyeOffset -= 0.1;
-                    if (entity.eyeOffset <= -5)
-                        entity.eyeMovingRight = true;
-                }
-            }
-            }
+// Lee la topología de las CPUs en las que el proceso puede correr
+std::vector<CpuInfo> readTopology()
+{
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    sched_getaffinity(0, sizeof(allowed), &allowed);
 
-            // Actualizar el estado de visibilidad
-            if (!entity.isPacman && !entity.isVisible)
+    std::vector<int> nodeOf(CPU_SETSIZE, 0);
+    for (int node = 0; node < 1024; ++node)
+    {
+        std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!file)
+        {
+            if (node > 0)
+                break;
+            continue;
+        }
+        std::string text;
+        std::getline(file, text);
+        std::vector<int> cpus;
+        if (parseCpuList(text, cpus))
+        {
+            for (int cpu : cpus)
             {
-                if (currentTime - entity.invisibleTime >= 2000) // 2000 milisegundos = 2 segundos
-                {
-                    #pragma omp atomic write
-                    entity.isVisible = true;
-                }
+                if (cpu < CPU_SETSIZE)
+                    nodeOf[cpu] = node;
             }
         }
-        
+    }
+
+    std::vector<CpuInfo> topology;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &allowed))
+        {
+            continue;
+        }
+        std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        CpuInfo info;
+        info.cpu = cpu;
+        info.node = nodeOf[cpu];
+        info.package = readSysfsInt(base + "physical_package_id", 0);
+        info.core = readSysfsInt(base + "core_id", cpu);
+        info.sibling = 0;
+        for (const CpuInfo &previous : topology)
+        {
+            if (previous.package == info.package && previous.core == info.core)
+                info.sibling++;
+        }
+        topology.push_back(info);
+    }
+    return topology;
+}
+
+// Orden en que se asignan las CPUs a los hilos según la política
+std::vector<int> placementOrder(const std::vector<CpuInfo> &topology)
+{
+    std::vector<CpuInfo> sorted = topology;
+    std::vector<int> order;
+
+    if (options.pin == PIN_LIST)
+    {
+        return options.pinCpus;
+    }
+    if (options.pin == PIN_COMPACT)
+    {
+        std::sort(sorted.begin(), sorted.end(), [](const CpuInfo &a, const CpuInfo &b) {
+            return std::make_tuple(a.node, a.package, a.core, a.cpu) < std::make_tuple(b.node, b.package, b.core, b.cpu);
+        });
+        for (const CpuInfo &info : sorted)
+            order.push_back(info.cpu);
+        return order;
+    }
+
+    // Scatter: dentro de cada nodo primero un hilo por núcleo físico, y los
+    // nodos se van alternando
+    std::sort(sorted.begin(), sorted.end(), [](const CpuInfo &a, const CpuInfo &b) {
+        return std::make_tuple(a.node, a.sibling, a.package, a.core) < std::make_tuple(b.node, b.sibling, b.package, b.core);
+    });
+    std::vector<std::vector<int>> perNode;
+    for (size_t k = 0; k < sorted.size(); ++k)
+    {
+        if (k == 0 || sorted[k].node != sorted[k - 1].node)
+            perNode.emplace_back();
+        perNode.back().push_back(sorted[k].cpu);
+    }
+    for (size_t k = 0; order.size() < sorted.size(); ++k)
+    {
+        for (const std::vector<int> &cpus : perNode)
+        {
+            if (k < cpus.size())
+                order.push_back(cpus[k]);
+        }
+    }
+    return order;
+}
+
+// Fija cada hilo del equipo de OpenMP a su CPU e informa dónde quedó cada uno
+void setupThreads()
+{
+    omp_set_dynamic(0);
+    omp_set_num_threads(options.numThreads);
+
+    std::vector<CpuInfo> topology = readTopology();
+    std::vector<int> order;
+    if (options.pin != PIN_NONE)
+    {
+        order = placementOrder(topology);
+    }
+
+    std::vector<int> cpuOf(options.numThreads, -1);
+    std::vector<char> pinned(options.numThreads, 0);
+    #pragma omp parallel
+    {
+        int tid = omp_get_thread_num();
+        if (!order.empty())
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(order[tid % order.size()], &set);
+            pinned[tid] = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+        }
+        cpuOf[tid] = sched_getcpu();
+    }
+
+    const char *policyNames[] = {"none", "compact", "scatter", "list"};
+    std::cout << "Threads: " << options.numThreads << " (pin: " << policyNames[options.pin] << ")" << std::endl;
+    for (int tid = 0; tid < options.numThreads; ++tid)
+    {
+        int node = 0;
+        for (const CpuInfo &info : topology)
+        {
+            if (info.cpu == cpuOf[tid])
+                node = info.node;
+        }
+        std::cout << "  thread " << tid << " -> cpu " << cpuOf[tid] << " node " << node;
+        if (!order.empty() && !pinned[tid])
+        {
+            std::cout << " (pinning failed)";
+        }
+        std::cout << std::endl;
+    }
+}
+
+// Fases del ciclo principal que se miden por separado
+enum Phase
+{
+    PHASE_COLLISION,
+    PHASE_INTEGRATION,
+    PHASE_DRAW,
+    PHASE_PRESENT,
+    PHASE_COUNT
+};
+
+const char *phaseNames[PHASE_COUNT] = {"collision", "integration", "draw", "present"};
+static_assert(static_cast<int>(PHASE_COUNT) == static_cast<int>(TELEMETRY_PHASES), "telemetry.h must list the same phases");
+
+// Contadores de hardware de cada grupo; el primero (ciclos) es el líder
+enum Counter
+{
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_STALLED_CYCLES,
+    COUNTER_COUNT
+};
+
+const Uint32 counterConfigs[COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES,
+    PERF_COUNT_HW_STALLED_CYCLES_BACKEND,
+};
+
+struct PhaseTotals
+{
+    double seconds = 0;
+    uint64_t counters[COUNTER_COUNT] = {};
+};
+
+// Un perfil por hilo, alineado para que los hilos no compartan líneas de caché
+struct alignas(64) ThreadProfile
+{
+    int leaderFd = -1;
+    int memberFds[COUNTER_COUNT]; // Los demás contadores del grupo (-1 si no abrió)
+    int slotOf[COUNTER_COUNT]; // Posición de cada contador en la lectura del grupo (-1 si no abrió)
+    int slots = 0;
+    double startTime = 0;
+    uint64_t startValues[COUNTER_COUNT] = {};
+    PhaseTotals phases[PHASE_COUNT];
+};
+
+std::vector<ThreadProfile> profiles;
+bool countersAvailable = false;
+
+int openCounter(Uint32 config, int groupFd)
+{
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = groupFd == -1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // pid = 0 y cpu = -1: cuenta solo el hilo que lo abre, en cualquier CPU
+    return syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+}
+
+// Lee el grupo de contadores del hilo, escalando si el kernel los multiplexó
+bool readCounters(ThreadProfile &profile, uint64_t values[COUNTER_COUNT])
+{
+    uint64_t buffer[3 + COUNTER_COUNT];
+    if (read(profile.leaderFd, buffer, sizeof(buffer)) < static_cast<ssize_t>((3 + profile.slots) * sizeof(uint64_t)))
+    {
+        return false;
+    }
+    double scale = buffer[2] > 0 ? static_cast<double>(buffer[1]) / buffer[2] : 0;
+    for (int c = 0; c < COUNTER_COUNT; ++c)
+    {
+        values[c] = profile.slotOf[c] < 0 ? 0 : static_cast<uint64_t>(buffer[3 + profile.slotOf[c]] * scale);
+    }
+    return true;
+}
+
+// Cada hilo abre su propio grupo de contadores. Si no hay soporte (sin PMU,
+// perf_event_paranoid, contenedores) se mide solo el tiempo
+void setupProfiling()
+{
+    if (!options.perf)
+    {
+        return;
+    }
+    profiles.assign(options.numThreads, ThreadProfile());
+    int opened = 0;
+    #pragma omp parallel reduction(+ : opened)
+    {
+        ThreadProfile &profile = profiles[omp_get_thread_num()];
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+        {
+            profile.slotOf[c] = -1;
+            profile.memberFds[c] = -1;
+        }
+        profile.leaderFd = openCounter(counterConfigs[COUNTER_CYCLES], -1);
+        if (profile.leaderFd >= 0)
+        {
+            profile.slotOf[COUNTER_CYCLES] = profile.slots++;
+            for (int c = COUNTER_CYCLES + 1; c < COUNTER_COUNT; ++c)
+            {
+                profile.memberFds[c] = openCounter(counterConfigs[c], profile.leaderFd);
+                if (profile.memberFds[c] >= 0)
+                {
+                    profile.slotOf[c] = profile.slots++;
+                }
+            }
+            ioctl(profile.leaderFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(profile.leaderFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            opened = 1;
+        }
+    }
+    countersAvailable = opened == options.numThreads;
+}
+
+void profileBegin(int tid)
+{
+    if (!options.perf)
+    {
+        return;
+    }
+    ThreadProfile &profile = profiles[tid];
+    if (countersAvailable)
+    {
+        readCounters(profile, profile.startValues);
+    }
+    profile.startTime = omp_get_wtime();
+}
+
+void profileEnd(int tid, Phase phase)
+{
+    if (!options.perf)
+    {
+        return;
+    }
+    ThreadProfile &profile = profiles[tid];
+    PhaseTotals &totals = profile.phases[phase];
+    totals.seconds += omp_get_wtime() - profile.startTime;
+    uint64_t values[COUNTER_COUNT];
+    if (countersAvailable && readCounters(profile, values))
+    {
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+        {
+            totals.counters[c] += values[c] - std::min(values[c], profile.startValues[c]);
+        }
+    }
+}
+
+void printPhaseRow(const std::string &label, const PhaseTotals &totals)
+{
+    std::cout << std::left << std::setw(24) << label << std::right << std::fixed << std::setprecision(1)
+              << std::setw(11) << totals.seconds * 1000;
+    if (countersAvailable)
+    {
+        const uint64_t *c = totals.counters;
+        double ipc = c[COUNTER_CYCLES] > 0 ? static_cast<double>(c[COUNTER_INSTRUCTIONS]) / c[COUNTER_CYCLES] : 0;
+        std::cout << std::setw(16) << c[COUNTER_CYCLES] << std::setw(16) << c[COUNTER_INSTRUCTIONS]
+                  << std::setw(7) << std::setprecision(2) << ipc << std::setw(14) << c[COUNTER_CACHE_MISSES]
+                  << std::setw(14) << c[COUNTER_BRANCH_MISSES] << std::setw(16) << c[COUNTER_STALLED_CYCLES];
+    }
+    std::cout << std::endl;
+}
+
+// Resumen al salir: totales por fase y el desglose por hilo
+void reportProfiling()
+{
+    if (!options.perf)
+    {
+        return;
+    }
+    std::cout << std::endl << "Profile (" << (countersAvailable ? "hardware counters" : "counters unavailable, timing only") << ")" << std::endl;
+    std::cout << std::left << std::setw(24) << "phase" << std::right << std::setw(11) << "ms";
+    if (countersAvailable)
+    {
+        std::cout << std::setw(16) << "cycles" << std::setw(16) << "instructions" << std::setw(7) << "IPC"
+                  << std::setw(14) << "cache-misses" << std::setw(14) << "branch-misses" << std::setw(16) << "stalled-cycles";
+    }
+    std::cout << std::endl;
+
+    for (int phase = 0; phase < PHASE_COUNT; ++phase)
+    {
+        PhaseTotals sum;
+        for (const ThreadProfile &profile : profiles)
+        {
+            sum.seconds += profile.phases[phase].seconds;
+            for (int c = 0; c < COUNTER_COUNT; ++c)
+                sum.counters[c] += profile.phases[phase].counters[c];
+        }
+        printPhaseRow(phaseNames[phase], sum);
+    }
+    for (size_t tid = 0; tid < profiles.size(); ++tid)
+    {
+        for (int phase = 0; phase < PHASE_COUNT; ++phase)
+        {
+            if (profiles[tid].phases[phase].seconds > 0)
+                printPhaseRow("  thread " + std::to_string(tid) + " " + phaseNames[phase], profiles[tid].phases[phase]);
+        }
+    }
+
+    for (ThreadProfile &profile : profiles)
+    {
+        for (int c = 0; c < COUNTER_COUNT; ++c)
+        {
+            if (profile.memberFds[c] >= 0)
+                close(profile.memberFds[c]);
+        }
+        if (profile.leaderFd >= 0)
+            close(profile.leaderFd);
+    }
+}
+
+// Cómo se reparte una fase: cantidad de hilos y chunk (0 = reparto estático)
+struct PhasePlan
+{
+    int threads;
+    int chunk;
+};
+
+// Tamaño de trabajo bajo el cual un equipo de hilos cuesta más de lo que
+// ahorra. Se calibra al arrancar
+int serialThreshold = 0;
+
+// Controlador en línea de una fase: mide cada candidato unos frames, usa el
+// más rápido por un rato y vuelve a medir, o antes si el trabajo cambió mucho
+struct PhaseController
+{
+    std::vector<PhasePlan> candidates;
+    std::vector<double> seconds;
+    int current = 0;
+    int best = 0;
+    int framesLeft = 0;
+    bool exploring = true;
+    int decidedWork = 0;
+    int lastThreads = 1; // Hilos del último plan entregado
+    // Sobre el umbral usa siempre el equipo completo con reparto estático, sin
+    // probar candidatos. Es para las fases que recorren los arreglos por
+    // índice, así cada hilo trabaja el bloque que tocó primero al generarlos
+    bool fixedTeam = false;
+
+    void reset(int maxThreads)
+    {
+        candidates.clear();
+        candidates.push_back(PhasePlan{1, 0});
+        for (int threads = 2; threads < 2 * maxThreads; threads *= 2)
+        {
+            int t = std::min(threads, maxThreads);
+            candidates.push_back(PhasePlan{t, 0});
+            candidates.push_back(PhasePlan{t, 256});
+            if (t == maxThreads)
+                break;
+        }
+        startExploring(0);
+    }
+
+    void startExploring(int work)
+    {
+        seconds.assign(candidates.size(), 0);
+        current = 0;
+        framesLeft = EXPLORE_FRAMES;
+        exploring = true;
+        decidedWork = work;
+    }
+
+    PhasePlan plan(int work)
+    {
+        PhasePlan chosen = choose(work);
+        lastThreads = chosen.threads;
+        return chosen;
+    }
+
+    PhasePlan choose(int work)
+    {
+        if (!options.adaptive)
+        {
+            return PhasePlan{options.numThreads, 0};
+        }
+        if (work < serialThreshold || candidates.size() == 1)
+        {
+            return candidates[0];
+        }
+        if (fixedTeam)
+        {
+            return PhasePlan{options.numThreads, 0};
+        }
+        if (!exploring && (framesLeft <= 0 || work > 2 * decidedWork || 2 * work < decidedWork))
+        {
+            startExploring(work);
+        }
+        return candidates[exploring ? current : best];
+    }
+
+    void record(int work, double elapsed)
+    {
+        if (!options.adaptive || fixedTeam || work < serialThreshold)
+        {
+            return;
+        }
+        framesLeft--;
+        if (!exploring)
+        {
+            return;
+        }
+        seconds[current] += elapsed;
+        if (framesLeft > 0)
+        {
+            return;
+        }
+        if (++current < static_cast<int>(candidates.size()))
+        {
+            framesLeft = EXPLORE_FRAMES;
+            return;
+        }
+        best = std::min_element(seconds.begin(), seconds.end()) - seconds.begin();
+        exploring = false;
+        framesLeft = EXPLOIT_FRAMES;
+    }
+};
+
+// Aplica el plan a los `omp for schedule(runtime)` de la fase
+int applyPlan(const PhasePlan &plan)
+{
+    omp_set_schedule(plan.chunk == 0 ? omp_sched_static : omp_sched_dynamic, plan.chunk);
+    return plan.threads;
+}
+
+// Compara el costo de abrir un equipo de hilos con el costo por elemento de un
+// kernel parecido a la integración y deja el umbral donde se empatan (con margen)
+void calibrateSerialThreshold()
+{
+    if (options.numThreads == 1)
+    {
+        return;
+    }
+
+    const int repetitions = 200;
+    double start = omp_get_wtime();
+    for (int r = 0; r < repetitions; ++r)
+    {
+        #pragma omp parallel
+        {
+            #pragma omp for schedule(static)
+            for (int i = 0; i < options.numThreads; ++i)
+            {
+            }
+        }
+    }
+    double teamCost = (omp_get_wtime() - start) / repetitions;
+
+    std::vector<int> position(1 << 16), velocity(1 << 16);
+    for (size_t i = 0; i < position.size(); ++i)
+    {
+        position[i] = i % SCREEN_WIDTH;
+        velocity[i] = i % 7 - 3;
+    }
+    start = omp_get_wtime();
+    for (int r = 0; r < 20; ++r)
+    {
+        for (size_t i = 0; i < position.size(); ++i)
+        {
+            position[i] += velocity[i];
+            if (position[i] < 0 || position[i] > SCREEN_WIDTH)
+                velocity[i] = -velocity[i];
+        }
+    }
+    double itemCost = std::max((omp_get_wtime() - start) / (20.0 * position.size()), 1e-10);
+    volatile int sink = position[position.size() / 2];
+    (void)sink;
+
+    serialThreshold = std::min(std::max(static_cast<int>(2 * teamCost / itemCost), 64), 1 << 20);
+}
+
+// Entrada de la grilla: la posición de ancla con la que se insertó la entidad
+struct GridEntry
+{
+    int id;
+    int x, y;
+    int radius;
+};
+
+// Grilla uniforme sobre la pantalla con inserción y borrado por entidad
+struct SpatialGrid
+{
+    std::vector<std::vector<GridEntry>> cells;
+    std::vector<int> cellOf; // Celda de cada entidad, -1 si no está
+
+    void reset(int numEntities)
+    {
+        cells.assign(GRID_COLS * GRID_ROWS, std::vector<GridEntry>());
+        cellOf.assign(numEntities, -1);
+    }
+
+    static int cellIndex(int x, int y)
+    {
+        int col = std::min(std::max(x / GRID_CELL, 0), GRID_COLS - 1);
+        int row = std::min(std::max(y / GRID_CELL, 0), GRID_ROWS - 1);
+        return row * GRID_COLS + col;
+    }
+
+    void insert(int id, int x, int y, int radius)
+    {
+        int cell = cellIndex(x, y);
+        cells[cell].push_back(GridEntry{id, x, y, radius});
+        cellOf[id] = cell;
+    }
+
+    void remove(int id)
+    {
+        if (cellOf[id] < 0)
+        {
+            return;
+        }
+        std::vector<GridEntry> &cell = cells[cellOf[id]];
+        for (size_t k = 0; k < cell.size(); ++k)
+        {
+            if (cell[k].id == id)
+            {
+                cell[k] = cell.back();
+                cell.pop_back();
+                break;
+            }
+        }
+        cellOf[id] = -1;
+    }
+
+    // Llama a visit(entry) para cada entrada en las celdas que tocan el rectángulo
+    template <typename Visit>
+    void query(int x0, int y0, int x1, int y1, Visit visit) const
+    {
+        int first = cellIndex(x0, y0);
+        int last = cellIndex(x1, y1);
+        for (int row = first / GRID_COLS; row <= last / GRID_COLS; ++row)
+        {
+            for (int col = first % GRID_COLS; col <= last % GRID_COLS; ++col)
+            {
+                for (const GridEntry &entry : cells[row * GRID_COLS + col])
+                {
+                    visit(entry);
+                }
+            }
+        }
+    }
+};
+
+// Par de entidades cercanas, guardado una sola vez como (a, b) con a < b
+struct Contact
+{
+    uint64_t key;
+    int a, b;
+};
+
+uint64_t pairKey(int a, int b)
+{
+    return (static_cast<uint64_t>(std::min(a, b)) << 32) | static_cast<uint32_t>(std::max(a, b));
+}
+
+// Los pares se guardan en una lista por combinación de tipos, así cada lista se
+// prueba con un manejador especializado. Como los Pacman tienen los
+// identificadores más bajos, en un par mixto a es siempre el Pacman
+enum PairKind
+{
+    PAIR_PACMAN_PACMAN,
+    PAIR_PACMAN_GHOST,
+    PAIR_GHOST_GHOST,
+    PAIR_KINDS
+};
+
+PairKind pairKind(int a, int b, int numPacmans)
+{
+    if (b < numPacmans)
+        return PAIR_PACMAN_PACMAN;
+    return a < numPacmans ? PAIR_PACMAN_GHOST : PAIR_GHOST_GHOST;
+}
+
+// Caché persistente de pares cercanos, ordenada por clave. Solo se vuelven a
+// buscar vecinos de las entidades que se alejaron de su ancla, así la mayoría
+// de los frames solo se verifican los pares ya conocidos.
+//
+// Las entidades quietas y sin contactos se duermen: pasan de la grilla dinámica
+// a la estática, dejan de integrarse y de revisarse, y solo las despierta un
+// contacto. Como no se mueven, sus pares y su ancla siguen siendo válidos
+struct ContactCache
+{
+    SpatialGrid grid;       // Entidades despiertas
+    SpatialGrid staticGrid; // Entidades dormidas, solo cambia al dormir o despertar
+    std::vector<Contact> pairs[PAIR_KINDS];
+    std::vector<int> anchorX, anchorY;
+    std::vector<char> refresh;      // Entidades cuyos pares hay que rehacer este frame
+    std::vector<int> refreshList;
+    std::vector<std::vector<Contact>> found; // Pares nuevos encontrados por cada hilo
+    int tracked = 0;                         // Las entidades [0, tracked) están en alguna grilla
+
+    std::vector<char> asleep;
+    std::vector<unsigned char> quietFrames;
+    std::vector<char> touched; // Tuvo un contacto en este frame
+    std::vector<int> active;   // Entidades despiertas con índice < activeLimit, en orden
+    int activePacmans = 0;     // Las primeras activePacmans de active son Pacman
+    int activeLimit = -1;
+    int numPacmans = 0;
+
+    void reset(int pacmanCount, int numEntities, int numThreads)
+    {
+        numPacmans = pacmanCount;
+        grid.reset(numEntities);
+        staticGrid.reset(numEntities);
+        for (std::vector<Contact> &list : pairs)
+        {
+            list.clear();
+        }
+        anchorX.assign(numEntities, 0);
+        anchorY.assign(numEntities, 0);
+        refresh.assign(numEntities, 0);
+        found.assign(numThreads, std::vector<Contact>());
+        tracked = 0;
+        asleep.assign(numEntities, 0);
+        quietFrames.assign(numEntities, 0);
+        touched.assign(numEntities, 0);
+        active.clear();
+        activePacmans = 0;
+        activeLimit = -1;
+    }
+
+    size_t pairCount() const
+    {
+        return pairs[PAIR_PACMAN_PACMAN].size() + pairs[PAIR_PACMAN_GHOST].size() + pairs[PAIR_GHOST_GHOST].size();
+    }
+
+    // La lista de despiertas solo se rehace cuando alguien se duerme, se
+    // despierta o entra por la rampa
+    void updateActive(int limit)
+    {
+        if (limit == activeLimit)
+        {
+            return;
+        }
+        active.clear();
+        for (int i = 0; i < limit; ++i)
+        {
+            if (!asleep[i])
+                active.push_back(i);
+        }
+        activePacmans = std::lower_bound(active.begin(), active.end(), numPacmans) - active.begin();
+        activeLimit = limit;
+    }
+
+    template <typename W>
+    void sleep(W &world, int id)
+    {
+        // Se guarda con su ancla, que ya está a menos de medio margen
+        grid.remove(id);
+        staticGrid.insert(id, anchorX[id], anchorY[id], world.with(id, [](const auto &e) -> int { return e.radius; }));
+        asleep[id] = 1;
+        activeLimit = -1;
+    }
+
+    template <typename W>
+    void wake(W &world, int id)
+    {
+        staticGrid.remove(id);
+        grid.insert(id, anchorX[id], anchorY[id], world.with(id, [](const auto &e) -> int { return e.radius; }));
+        asleep[id] = 0;
+        quietFrames[id] = 0;
+        activeLimit = -1;
+    }
+
+    template <typename T>
+    bool drifted(int id, const T &entity) const
+    {
+        int dx = entity.x - anchorX[id];
+        int dy = entity.y - anchorY[id];
+        return 4 * (dx * dx + dy * dy) > CONTACT_MARGIN * CONTACT_MARGIN;
+    }
+
+    // Marca para reanclar las despiertas active[first, last) de un arreglo cuyo
+    // primer identificador es base. Se llama dentro de la región paralela
+    template <typename T>
+    void markDrifted(const ArchetypeBuffer<T> &entities, int base, int first, int last)
+    {
+        #pragma omp for schedule(runtime) nowait
+        for (int k = first; k < last; ++k)
+        {
+            int i = active[k];
+            refresh[i] = i >= tracked || drifted(i, entities[i - base]);
+        }
+    }
+
+    // Saca los pares de las entidades que se van a reanclar y las mueve en la grilla
+    template <typename W>
+    void reanchor(W &world, int limit)
+    {
+        refreshList.clear();
+        for (int i : active)
+        {
+            if (refresh[i])
+                refreshList.push_back(i);
+        }
+        if (refreshList.empty())
+        {
+            return;
+        }
+
+        for (std::vector<Contact> &list : pairs)
+        {
+            list.erase(std::remove_if(list.begin(), list.end(), [this](const Contact &contact) {
+                           return refresh[contact.a] || refresh[contact.b];
+                       }),
+                       list.end());
+        }
+
+        for (int id : refreshList)
+        {
+            grid.remove(id);
+            world.with(id, [&](const auto &entity) {
+                anchorX[id] = entity.x;
+                anchorY[id] = entity.y;
+                grid.insert(id, entity.x, entity.y, entity.radius);
+            });
+        }
+        tracked = limit;
+    }
+
+    // Busca en la grilla los vecinos engordados de una entidad reanclada
+    template <typename W>
+    void findPairs(W &world, int id, std::vector<Contact> &out) const
+    {
+        int radius = world.with(id, [](const auto &e) -> int { return e.radius; });
+        int reach = radius + MAX_RADIUS + CONTACT_MARGIN;
+        int x = anchorX[id], y = anchorY[id];
+        auto visit = [&](const GridEntry &entry) {
+            // Si las dos se reanclaron, el par lo agrega solo la de menor índice
+            if (entry.id == id || (refresh[entry.id] && entry.id < id))
+            {
+                return;
+            }
+            int dx = entry.x - x;
+            int dy = entry.y - y;
+            int fat = radius + entry.radius + CONTACT_MARGIN;
+            if (dx * dx + dy * dy < fat * fat)
+            {
+                out.push_back(Contact{pairKey(id, entry.id), std::min(id, entry.id), std::max(id, entry.id)});
+            }
+        };
+        grid.query(x - reach, y - reach, x + reach, y + reach, visit);
+        staticGrid.query(x - reach, y - reach, x + reach, y + reach, visit);
+    }
+
+    // Reparte los pares nuevos de todos los hilos en la lista de su tipo y las
+    // deja ordenadas
+    void mergeFound()
+    {
+        size_t existing[PAIR_KINDS];
+        for (int kind = 0; kind < PAIR_KINDS; ++kind)
+        {
+            existing[kind] = pairs[kind].size();
+        }
+        for (std::vector<Contact> &list : found)
+        {
+            for (const Contact &contact : list)
+            {
+                pairs[pairKind(contact.a, contact.b, numPacmans)].push_back(contact);
+            }
+            list.clear();
+        }
+        auto byKey = [](const Contact &l, const Contact &r) { return l.key < r.key; };
+        for (int kind = 0; kind < PAIR_KINDS; ++kind)
+        {
+            std::vector<Contact> &list = pairs[kind];
+            std::sort(list.begin() + existing[kind], list.end(), byKey);
+            std::inplace_merge(list.begin(), list.begin() + existing[kind], list.end(), byKey);
+        }
+        for (int id : refreshList)
+        {
+            refresh[id] = 0;
+        }
+    }
+};
+
+// Consultas espaciales sobre las grillas de la caché de contactos, que ya se
+// mantienen al día de forma incremental. Las grillas guardan la posición de
+// ancla, a menos de medio margen de la real, así que las celdas se recorren con
+// ese margen de más y la distancia final se mide con la posición actual
+enum QueryFilter : unsigned
+{
+    QUERY_PACMANS = 1,
+    QUERY_GHOSTS = 2,
+    QUERY_VISIBLE = 4, // Deja afuera a los fantasmas comidos
+    QUERY_ALL = QUERY_PACMANS | QUERY_GHOSTS
+};
+
+struct Neighbor
+{
+    int id;
+    int x, y;
+    int distanceSq;
+};
+
+bool shownEntity(const Pacman &) { return true; }
+bool shownEntity(const Ghost &ghost) { return ghost.isVisible; }
+bool shownEntity(const CompactPacman &) { return true; }
+bool shownEntity(const CompactGhost &ghost) { return ghost.isVisible; }
+
+// Posición actual de una entidad si pasa el filtro
+template <typename W>
+bool lookupEntity(const W &world, int id, unsigned filter, int &x, int &y)
+{
+    unsigned type = id < world.pacmans.size() ? QUERY_PACMANS : QUERY_GHOSTS;
+    if (!(filter & type))
+    {
+        return false;
+    }
+    return world.with(id, [&](const auto &entity) {
+        x = entity.x;
+        y = entity.y;
+        return !(filter & QUERY_VISIBLE) || shownEntity(entity);
+    });
+}
+
+// Llama a visit(neighbor) para cada entidad que pasa el filtro a distancia
+// menor o igual a radius de (x, y)
+template <typename W, typename Visit>
+void queryRadius(const W &world, int x, int y, int radius, unsigned filter, Visit visit)
+{
+    int reach = radius + CONTACT_MARGIN / 2;
+    auto test = [&](const GridEntry &entry) {
+        Neighbor neighbor;
+        if (!lookupEntity(world, entry.id, filter, neighbor.x, neighbor.y))
+        {
+            return;
+        }
+        int dx = neighbor.x - x;
+        int dy = neighbor.y - y;
+        neighbor.id = entry.id;
+        neighbor.distanceSq = dx * dx + dy * dy;
+        if (neighbor.distanceSq <= radius * radius)
+        {
+            visit(neighbor);
+        }
+    };
+    world.contacts.grid.query(x - reach, y - reach, x + reach, y + reach, test);
+    world.contacts.staticGrid.query(x - reach, y - reach, x + reach, y + reach, test);
+}
+
+// Deja en out las k entidades más cercanas a (x, y) que pasan el filtro, a
+// distancia menor o igual a maxDistance, ordenadas de la más cercana a la más
+// lejana, y devuelve cuántas encontró. Recorre anillos de celdas crecientes y
+// corta cuando el anillo siguiente ya no puede tener nada más cerca
+template <typename W>
+int queryNearest(const W &world, int x, int y, int k, int maxDistance, unsigned filter, Neighbor *out, int exclude = -1)
+{
+    int found = 0;
+    int limitSq = maxDistance * maxDistance;
+    auto test = [&](const GridEntry &entry) {
+        Neighbor neighbor;
+        if (entry.id == exclude || !lookupEntity(world, entry.id, filter, neighbor.x, neighbor.y))
+        {
+            return;
+        }
+        int dx = neighbor.x - x;
+        int dy = neighbor.y - y;
+        neighbor.id = entry.id;
+        neighbor.distanceSq = dx * dx + dy * dy;
+        if (neighbor.distanceSq > limitSq || (found == k && neighbor.distanceSq >= out[k - 1].distanceSq))
+        {
+            return;
+        }
+        int slot = found < k ? found++ : k - 1;
+        while (slot > 0 && out[slot - 1].distanceSq > neighbor.distanceSq)
+        {
+            out[slot] = out[slot - 1];
+            slot--;
+        }
+        out[slot] = neighbor;
+    };
+
+    int center = SpatialGrid::cellIndex(x, y);
+    int col = center % GRID_COLS, row = center / GRID_COLS;
+    for (int ring = 0; ring <= std::max(GRID_COLS, GRID_ROWS); ++ring)
+    {
+        // Lo más cerca que puede estar una entidad guardada en este anillo
+        int ringDistance = std::max((ring - 1) * GRID_CELL - CONTACT_MARGIN / 2, 0);
+        if (ringDistance * ringDistance > limitSq || (found == k && ringDistance * ringDistance > out[k - 1].distanceSq))
+        {
+            break;
+        }
+        for (int r = row - ring; r <= row + ring; ++r)
+        {
+            for (int c = col - ring; c <= col + ring; ++c)
+            {
+                bool onRing = r == row - ring || r == row + ring || c == col - ring || c == col + ring;
+                if (!onRing || r < 0 || r >= GRID_ROWS || c < 0 || c >= GRID_COLS)
+                {
+                    continue;
+                }
+                for (const GridEntry &entry : world.contacts.grid.cells[r * GRID_COLS + c])
+                    test(entry);
+                for (const GridEntry &entry : world.contacts.staticGrid.cells[r * GRID_COLS + c])
+                    test(entry);
+            }
+        }
+    }
+    return found;
+}
+
+// Resultado de un contacto, emitido por la fase paralela y aplicado después
+enum EventType : Uint8
+{
+    EVENT_GHOST_EATEN, // El Pacman a se come al fantasma b
+    EVENT_BOUNCE       // a y b se separan e intercambian velocidades
+};
+
+// Las entidades salen del par, que no cambia entre la emisión y la aplicación
+struct CollisionEvent
+{
+    EventType type;
+    int pair; // Índice del par en la lista de su tipo, para mezclar en orden de clave
+};
+
+// Qué eventos produce un contacto según los tipos del par. Salvo Pacman con
+// fantasma, todos los pares solo rebotan
+template <typename A, typename B>
+void emitContact(const A &, const B &, int pair, std::vector<CollisionEvent> &events)
+{
+    events.push_back(CollisionEvent{EVENT_BOUNCE, pair});
+}
+
+void emitContact(const Pacman &, const Ghost &ghost, int pair, std::vector<CollisionEvent> &events)
+{
+    if (ghost.isVisible)
+        events.push_back(CollisionEvent{EVENT_GHOST_EATEN, pair});
+    events.push_back(CollisionEvent{EVENT_BOUNCE, pair});
+}
+
+void emitContact(const CompactPacman &, const CompactGhost &ghost, int pair, std::vector<CollisionEvent> &events)
+{
+    if (ghost.isVisible)
+        events.push_back(CollisionEvent{EVENT_GHOST_EATEN, pair});
+    events.push_back(CollisionEvent{EVENT_BOUNCE, pair});
+}
+
+// Solo un fantasma se puede comer; los otros pares nunca emiten ese evento.
+// Varios Pacman pueden tocar al mismo fantasma en un paso
+bool eat(Ghost &ghost, Uint32 currentTime)
+{
+    if (!ghost.isVisible)
+    {
+        return false;
+    }
+    ghost.isVisible = false;
+    ghost.invisibleTime = currentTime;
+    return true;
+}
+
+bool eat(CompactGhost &ghost, Uint32 currentTime)
+{
+    if (!ghost.isVisible)
+    {
+        return false;
+    }
+    ghost.isVisible = false;
+    ghost.invisibleTime = currentTime;
+    return true;
+}
+
+template <typename T>
+bool eat(T &, Uint32)
+{
+    return false;
+}
+
+// Contadores que salen del flujo de eventos
+struct CollisionStats
+{
+    long contacts = 0;
+    long ghostsEaten = 0;
+};
+
+// Un buffer de solo agregado por hilo y tipo de par: en el ciclo caliente nadie
+// escribe sobre entidades ajenas ni se sincroniza. Cada hilo recibe sus
+// iteraciones en orden creciente, así cada buffer ya está ordenado por par y al
+// final se mezclan en orden de clave sin importar cuántos hilos ni qué reparto
+// se usó. Los tipos de par se aplican uno detrás de otro, siempre en el mismo orden
+struct CollisionEvents
+{
+    std::vector<std::vector<CollisionEvent>> perThread[PAIR_KINDS];
+    std::vector<size_t> heads;
+    CollisionStats frame; // Del último paso
+    CollisionStats total; // Acumulado desde el último reporte
+
+    void reset(int numThreads)
+    {
+        for (int kind = 0; kind < PAIR_KINDS; ++kind)
+        {
+            perThread[kind].assign(numThreads, std::vector<CollisionEvent>());
+        }
+    }
+
+    template <typename W, typename A, typename B>
+    void applyKind(W &world, PairKind kind, ArchetypeBuffer<A> &as, int aBase, ArchetypeBuffer<B> &bs, int bBase, Uint32 currentTime)
+    {
+        std::vector<std::vector<CollisionEvent>> &buffers = perThread[kind];
+        ContactCache &contacts = world.contacts;
+        const std::vector<Contact> &pairs = contacts.pairs[kind];
+        heads.assign(buffers.size(), 0);
+        while (true)
+        {
+            // Siguiente evento de la mezcla: el de menor par entre las cabezas
+            int next = -1;
+            for (size_t t = 0; t < buffers.size(); ++t)
+            {
+                if (heads[t] < buffers[t].size() &&
+                    (next < 0 || buffers[t][heads[t]].pair < buffers[next][heads[next]].pair))
+                    next = t;
+            }
+            if (next < 0)
+            {
+                break;
+            }
+            const CollisionEvent &event = buffers[next][heads[next]++];
+            const Contact &contact = pairs[event.pair];
+            A &a = as[contact.a - aBase];
+            B &b = bs[contact.b - bBase];
+            if (event.type == EVENT_GHOST_EATEN)
+            {
+                frame.ghostsEaten += eat(b, currentTime);
+                continue;
+            }
+
+            if (contacts.asleep[contact.a])
+                contacts.wake(world, contact.a);
+            if (contacts.asleep[contact.b])
+                contacts.wake(world, contact.b);
+            contacts.touched[contact.a] = contacts.touched[contact.b] = 1;
+            resolveCollision(a, b);
+            frame.contacts++;
+        }
+        for (std::vector<CollisionEvent> &events : buffers)
+        {
+            events.clear();
+        }
+    }
+
+    // Aplica todos los eventos en una sola pasada y los descarta
+    template <typename W>
+    void apply(W &world, Uint32 currentTime)
+    {
+        int numPacmans = world.pacmans.size();
+        frame = CollisionStats();
+        applyKind(world, PAIR_PACMAN_PACMAN, world.pacmans, 0, world.pacmans, 0, currentTime);
+        applyKind(world, PAIR_PACMAN_GHOST, world.pacmans, 0, world.ghosts, numPacmans, currentTime);
+        applyKind(world, PAIR_GHOST_GHOST, world.ghosts, numPacmans, world.ghosts, numPacmans, currentTime);
+        total.contacts += frame.contacts;
+        total.ghostsEaten += frame.ghostsEaten;
+    }
+};
+
+// Prueba en paralelo los pares de un tipo con el manejador de ese tipo de par,
+// dejando los eventos en el buffer del hilo. Se llama dentro de la región paralela
+template <typename A, typename B>
+void testPairs(const std::vector<Contact> &pairs, std::vector<CollisionEvent> &events, const ArchetypeBuffer<A> &as, int aBase, const ArchetypeBuffer<B> &bs, int bBase)
+{
+    #pragma omp for schedule(runtime) nowait
+    for (size_t k = 0; k < pairs.size(); ++k)
+    {
+        const Contact &contact = pairs[k];
+        const A &a = as[contact.a - aBase];
+        const B &b = bs[contact.b - bBase];
+        if (checkCollision(a, b))
+        {
+            emitContact(a, b, static_cast<int>(k), events);
+        }
+    }
+}
+
+// Fase de colisiones: refresca la caché de pares, prueba en paralelo los pares
+// conocidos emitiendo eventos y al final los aplica, una vez por contacto
+template <typename W>
+void collisionStep(W &world, int limit, Uint32 currentTime)
+{
+    ContactCache &contacts = world.contacts;
+    contacts.updateActive(limit);
+
+    PhaseController &controller = world.controllers[PHASE_COLLISION];
+    int numPacmans = world.pacmans.size();
+    int work = contacts.active.size() + contacts.pairCount();
+    double start = omp_get_wtime();
+    #pragma omp parallel num_threads(applyPlan(controller.plan(work)))
+    {
+        int tid = omp_get_thread_num();
+        profileBegin(tid);
+
+        // Las dormidas no se mueven, así que solo se revisan las despiertas
+        contacts.markDrifted(world.pacmans, 0, 0, contacts.activePacmans);
+        contacts.markDrifted(world.ghosts, numPacmans, contacts.activePacmans, contacts.active.size());
+        #pragma omp barrier
+
+        #pragma omp single
+        contacts.reanchor(world, limit);
+
+        #pragma omp for schedule(runtime)
+        for (size_t k = 0; k < contacts.refreshList.size(); ++k)
+        {
+            contacts.findPairs(world, contacts.refreshList[k], contacts.found[tid]);
+        }
+
+        #pragma omp single
+        contacts.mergeFound();
+
+        testPairs(contacts.pairs[PAIR_PACMAN_PACMAN], world.events.perThread[PAIR_PACMAN_PACMAN][tid],
+                  world.pacmans, 0, world.pacmans, 0);
+        testPairs(contacts.pairs[PAIR_PACMAN_GHOST], world.events.perThread[PAIR_PACMAN_GHOST][tid],
+                  world.pacmans, 0, world.ghosts, numPacmans);
+        testPairs(contacts.pairs[PAIR_GHOST_GHOST], world.events.perThread[PAIR_GHOST_GHOST][tid],
+                  world.ghosts, numPacmans, world.ghosts, numPacmans);
+        #pragma omp barrier
+
+        #pragma omp single nowait
+        world.events.apply(world, currentTime);
+
+        profileEnd(tid, PHASE_COLLISION);
+    }
+    controller.record(work, omp_get_wtime() - start);
+}
+
+// Laberinto opcional (--maze FILE): un archivo de texto con una fila de tiles
+// por línea, '#' para pared y cualquier otro carácter para pasillo. Los tiles
+// son cuadrados, del mayor tamaño con el que el laberinto entra en la pantalla,
+// y todo lo que queda fuera del laberinto cuenta como pared. Las paredes son
+// de solo lectura y las comparten todas las escenas
+struct Maze
+{
+    int cols = 0, rows = 0;
+    int tile = 0;
+    std::vector<char> walls;
+
+    bool load(const std::string &path)
+    {
+        std::ifstream file(path);
+        std::vector<std::string> lines;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (!line.empty())
+                lines.push_back(line);
+        }
+        if (lines.empty())
+        {
+            std::cerr << "Could not read maze " << path << std::endl;
+            return false;
+        }
+
+        rows = lines.size();
+        cols = 0;
+        for (const std::string &text : lines)
+        {
+            cols = std::max<int>(cols, text.size());
+        }
+        tile = std::min(SCREEN_WIDTH / cols, SCREEN_HEIGHT / rows);
+        if (tile < 1)
+        {
+            std::cerr << "Maze " << path << " does not fit on the screen" << std::endl;
+            return false;
+        }
+        walls.assign(cols * rows, 1);
+        for (int row = 0; row < rows; ++row)
+        {
+            for (size_t col = 0; col < lines[row].size(); ++col)
+            {
+                walls[row * cols + col] = lines[row][col] == '#';
+            }
+        }
+        return true;
+    }
+
+    bool loaded() const { return tile > 0; }
+
+    static int floorDiv(int value, int divisor)
+    {
+        return value >= 0 ? value / divisor : -((-value + divisor - 1) / divisor);
+    }
+
+    bool wall(int col, int row) const
+    {
+        return col < 0 || row < 0 || col >= cols || row >= rows || walls[row * cols + col];
+    }
+
+    // Tile de un punto, -1 si está fuera del laberinto
+    int tileIndex(int x, int y) const
+    {
+        int col = floorDiv(x, tile), row = floorDiv(y, tile);
+        return col < 0 || row < 0 || col >= cols || row >= rows ? -1 : row * cols + col;
+    }
+
+    // Si un círculo se superpone con alguna pared
+    bool blocked(int x, int y, int radius) const
+    {
+        for (int row = floorDiv(y - radius, tile); row <= floorDiv(y + radius, tile); ++row)
+        {
+            for (int col = floorDiv(x - radius, tile); col <= floorDiv(x + radius, tile); ++col)
+            {
+                if (!wall(col, row))
+                {
+                    continue;
+                }
+                // Punto del tile más cercano al centro
+                int nearX = std::min(std::max(x, col * tile), col * tile + tile - 1);
+                int nearY = std::min(std::max(y, row * tile), row * tile + tile - 1);
+                int dx = x - nearX, dy = y - nearY;
+                if (dx * dx + dy * dy < radius * radius)
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Saca de las paredes a un círculo que un choque empujó adentro y hace
+    // rebotar su velocidad contra la pared
+    template <typename T>
+    void pushOut(T &entity) const
+    {
+        int x = entity.x, y = entity.y, radius = entity.radius;
+        for (int pass = 0; pass < 4 && blocked(x, y, radius); ++pass)
+        {
+            for (int row = floorDiv(y - radius, tile); row <= floorDiv(y + radius, tile); ++row)
+            {
+                for (int col = floorDiv(x - radius, tile); col <= floorDiv(x + radius, tile); ++col)
+                {
+                    if (!wall(col, row))
+                    {
+                        continue;
+                    }
+                    int left = col * tile, right = left + tile - 1;
+                    int top = row * tile, bottom = top + tile - 1;
+                    int dx = x - std::min(std::max(x, left), right);
+                    int dy = y - std::min(std::max(y, top), bottom);
+                    int distanceSq = dx * dx + dy * dy;
+                    if (distanceSq >= radius * radius)
+                    {
+                        continue;
+                    }
+                    if (distanceSq > 0)
+                    {
+                        // Se aleja del punto más cercano de la pared
+                        float distance = sqrt(distanceSq);
+                        float push = radius - distance + 1;
+                        x += std::lround(dx / distance * push);
+                        y += std::lround(dy / distance * push);
+                        if (dx * entity.xVel < 0)
+                            entity.xVel = -entity.xVel;
+                        if (dy * entity.yVel < 0)
+                            entity.yVel = -entity.yVel;
+                        continue;
+                    }
+                    // Centro dentro de la pared: sale por el lado libre más cercano
+                    const int exits[4][4] = {{col - 1, row, left - radius - x, 0},
+                                             {col + 1, row, right + 1 + radius - x, 0},
+                                             {col, row - 1, 0, top - radius - y},
+                                             {col, row + 1, 0, bottom + 1 + radius - y}};
+                    const int *best = nullptr;
+                    for (const int *exit : exits)
+                    {
+                        int cost = std::abs(exit[2]) + std::abs(exit[3]);
+                        if (!wall(exit[0], exit[1]) && (best == nullptr || cost < std::abs(best[2]) + std::abs(best[3])))
+                            best = exit;
+                    }
+                    if (best != nullptr)
+                    {
+                        x += best[2];
+                        y += best[3];
+                    }
+                }
+            }
+        }
+        entity.x = x;
+        entity.y = y;
+    }
+
+    // Busca un lugar libre para un círculo con los números de random; si no lo
+    // encuentra lo deja en el centro de un pasillo cualquiera
+    template <typename Random>
+    void place(Random &random, int radius, int &x, int &y) const
+    {
+        for (int attempt = 0; attempt < 64 && blocked(x, y, radius); ++attempt)
+        {
+            x = random.next() % (SCREEN_WIDTH - 2 * radius) + radius;
+            y = random.next() % (SCREEN_HEIGHT - 2 * radius) + radius;
+        }
+        for (int attempt = 0; attempt < 64 && blocked(x, y, radius); ++attempt)
+        {
+            int t = random.next() % (cols * rows);
+            if (!walls[t])
+            {
+                x = t % cols * tile + tile / 2;
+                y = t / cols * tile + tile / 2;
+            }
+        }
+    }
+
+    // Si un pixel de la pantalla cae en una pared del laberinto
+    bool wallPixel(int x, int y) const
+    {
+        int t = tileIndex(x, y);
+        return t >= 0 && walls[t];
+    }
+
+    // Pinta las paredes que caen en un rectángulo
+    void draw(SDL_Renderer *renderer, const SDL_Rect &rect) const
+    {
+        SDL_SetRenderDrawColor(renderer, 33, 33, 222, 255);
+        int r1 = std::min((rect.y + rect.h - 1) / tile, rows - 1);
+        int c1 = std::min((rect.x + rect.w - 1) / tile, cols - 1);
+        for (int row = rect.y / tile; row <= r1; ++row)
+        {
+            for (int col = rect.x / tile; col <= c1; ++col)
+            {
+                if (walls[row * cols + col])
+                {
+                    SDL_Rect wallRect{col * tile, row * tile, tile, tile};
+                    SDL_RenderFillRect(renderer, &wallRect);
+                }
+            }
+        }
+    }
+};
+
+Maze maze;
+
+// Los fantasmas no buscan caminos uno por uno: cada frame se calcula un solo
+// flow field, un BFS desde todos los tiles con Pacman, y cada fantasma va al
+// tile vecino con menor distancia. El costo es un recorrido de la grilla sin
+// importar cuántos fantasmas haya. Cada escena tiene el suyo
+struct FlowField
+{
+    std::vector<int> distance; // Pasos hasta el tile con Pacman más cercano, -1 si no se llega
+    std::vector<int> sources;  // Tiles con algún Pacman, desde donde arranca el BFS
+    std::vector<int> frontier;
+    std::vector<std::vector<int>> nextFrontier; // Por hilo
+
+    void reset(int numThreads)
+    {
+        distance.assign(maze.cols * maze.rows, -1);
+        nextFrontier.assign(numThreads, std::vector<int>());
+    }
+
+    // BFS por niveles desde los tiles fuente. Cada nivel reparte la frontera
+    // entre los hilos; un tile lo reclama el primero que lo alcanza, así las
+    // distancias no dependen del reparto
+    void build()
+    {
+        std::fill(distance.begin(), distance.end(), -1);
+        frontier.clear();
+        for (int t : sources)
+        {
+            if (t >= 0 && !maze.walls[t] && distance[t] < 0)
+            {
+                distance[t] = 0;
+                frontier.push_back(t);
+            }
+        }
+
+        #pragma omp parallel num_threads(nextFrontier.size()) if (maze.cols * maze.rows >= serialThreshold)
+        {
+            std::vector<int> &mine = nextFrontier[omp_get_thread_num()];
+            for (int level = 1; !frontier.empty(); ++level)
+            {
+                mine.clear();
+                #pragma omp for schedule(static)
+                for (size_t k = 0; k < frontier.size(); ++k)
+                {
+                    int t = frontier[k];
+                    int col = t % maze.cols, row = t / maze.cols;
+                    const int neighbors[4][2] = {{col - 1, row}, {col + 1, row}, {col, row - 1}, {col, row + 1}};
+                    for (const int *n : neighbors)
+                    {
+                        if (maze.wall(n[0], n[1]))
+                        {
+                            continue;
+                        }
+                        int next = n[1] * maze.cols + n[0];
+                        int unvisited = -1;
+                        if (__atomic_compare_exchange_n(&distance[next], &unvisited, level, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                        {
+                            mine.push_back(next);
+                        }
+                    }
+                }
+
+                #pragma omp single
+                {
+                    frontier.clear();
+                    for (const std::vector<int> &list : nextFrontier)
+                    {
+                        frontier.insert(frontier.end(), list.begin(), list.end());
+                    }
+                }
+            }
+        }
+    }
+
+    // Dirección desde (x, y) hacia el centro del tile vecino que baja en el
+    // flow field. Devuelve false si no hay a dónde bajar
+    bool downhill(int x, int y, int &dx, int &dy) const
+    {
+        int t = maze.tileIndex(x, y);
+        if (t < 0 || distance[t] <= 0)
+        {
+            return false;
+        }
+        int col = t % maze.cols, row = t / maze.cols;
+        const int neighbors[4][2] = {{col - 1, row}, {col + 1, row}, {col, row - 1}, {col, row + 1}};
+        int best = -1;
+        for (const int *n : neighbors)
+        {
+            int next = n[1] * maze.cols + n[0];
+            if (!maze.wall(n[0], n[1]) && distance[next] >= 0 && (best < 0 || distance[next] < distance[best]))
+                best = next;
+        }
+        if (best < 0 || distance[best] >= distance[t])
+        {
+            return false;
+        }
+        dx = best % maze.cols * maze.tile + maze.tile / 2 - x;
+        dy = best / maze.cols * maze.tile + maze.tile / 2 - y;
+        return true;
+    }
+};
+
+// Modo cinético (--kinetic): entre choques todo se mueve en línea recta a
+// velocidad constante, así que en vez de probar los pares en cada frame se
+// calcula el instante exacto de cada choque con los bordes y entre pares y se
+// guarda en una cola de prioridad. La simulación salta de evento en evento y
+// cada frame solo evalúa las posiciones en el tiempo de pantalla. El tiempo se
+// mide en frames, la unidad de las velocidades.
+//
+// Los eventos viejos no se sacan de la cola: cada entidad tiene un contador que
+// sube cuando cambia su velocidad, y un evento que guardó otro valor se
+// descarta al salir (invalidación perezosa). Un par solo entra a la cola si
+// choca antes del próximo borde de alguna de las dos, porque en ese borde esa
+// entidad vuelve a predecir todos sus pares
+enum KineticEventType : Uint8
+{
+    KINETIC_PAIR,   // a y b se tocan
+    KINETIC_WALL_X, // a llega a un borde izquierdo o derecho
+    KINETIC_WALL_Y  // a llega al borde de arriba o de abajo
+};
+
+struct KineticEvent
+{
+    double time;
+    int a, b; // b = -1 en los bordes
+    uint32_t versionA, versionB;
+    KineticEventType type;
+};
+
+// Orden total, para que el resultado no dependa del orden en que se insertó
+bool laterEvent(const KineticEvent &l, const KineticEvent &r)
+{
+    return std::tie(l.time, l.a, l.b, l.type) > std::tie(r.time, r.a, r.b, r.type);
+}
+
+struct KineticState
+{
+    std::vector<double> x, y, since; // Posición en el instante since
+    std::vector<int> xVel, yVel, radius;
+    std::vector<double> wallTime; // Próximo choque con un borde, infinito si está quieta
+    std::vector<uint32_t> version;
+    std::vector<KineticEvent> queue;              // Heap con el evento más próximo arriba
+    std::vector<std::vector<KineticEvent>> found; // Pares predichos por cada hilo
+    int active = 0;                               // Las entidades [0, active) ya entraron
+    int moving = 0;                               // Activas con velocidad distinta de cero
+    double now = 0;
+
+    void reset(int numEntities, int numThreads)
+    {
+        x.assign(numEntities, 0);
+        y.assign(numEntities, 0);
+        since.assign(numEntities, 0);
+        xVel.assign(numEntities, 0);
+        yVel.assign(numEntities, 0);
+        radius.assign(numEntities, 0);
+        wallTime.assign(numEntities, INFINITY);
+        version.assign(numEntities, 0);
+        queue.clear();
+        found.assign(numThreads, std::vector<KineticEvent>());
+        active = 0;
+        moving = 0;
+        now = 0;
+    }
+
+    double xAt(int i, double t) const { return x[i] + xVel[i] * (t - since[i]); }
+    double yAt(int i, double t) const { return y[i] + yVel[i] * (t - since[i]); }
+
+    // Deja a la entidad en el instante actual antes de cambiarle la velocidad,
+    // lo que invalida todos sus eventos
+    void settle(int i)
+    {
+        x[i] = xAt(i, now);
+        y[i] = yAt(i, now);
+        since[i] = now;
+        version[i]++;
+    }
+
+    void push(const KineticEvent &event)
+    {
+        queue.push_back(event);
+        std::push_heap(queue.begin(), queue.end(), laterEvent);
+    }
+
+    KineticEvent pop()
+    {
+        std::pop_heap(queue.begin(), queue.end(), laterEvent);
+        KineticEvent event = queue.back();
+        queue.pop_back();
+        return event;
+    }
+
+    bool stale(const KineticEvent &event) const
+    {
+        return version[event.a] != event.versionA || (event.b >= 0 && version[event.b] != event.versionB);
+    }
+
+    // Choques de pares todavía vigentes en la cola, el equivalente de los pares
+    // cercanos. Recorre toda la cola, así que no es para cada frame
+    int pendingPairs() const
+    {
+        int count = 0;
+        for (const KineticEvent &event : queue)
+        {
+            count += event.type == KINETIC_PAIR && !stale(event);
+        }
+        return count;
+    }
+
+    // Con muchos eventos vencidos se reconstruye la cola solo con los vigentes
+    void compact()
+    {
+        if (queue.size() < 1024 + 8 * static_cast<size_t>(active))
+        {
+            return;
+        }
+        queue.erase(std::remove_if(queue.begin(), queue.end(), [this](const KineticEvent &event) { return stale(event); }),
+                    queue.end());
+        std::make_heap(queue.begin(), queue.end(), laterEvent);
+    }
+
+    // Tiempo hasta que una coordenada llega a [low, high] yendo a velocidad
+    // velocity, 0 si ya está afuera yendo hacia afuera
+    static double borderTime(double position, int velocity, double low, double high)
+    {
+        if (velocity > 0)
+            return std::max((high - position) / velocity, 0.0);
+        if (velocity < 0)
+            return std::max((low - position) / velocity, 0.0);
+        return INFINITY;
+    }
+
+    // Tiempo hasta que i y j se tocan, infinito si no se están acercando, si
+    // pasan de largo o si ya están encimadas: las que entraron una sobre otra
+    // se atraviesan hasta separarse, porque separarlas de golpe las mete en
+    // otras y en escenas densas los choques en el mismo instante no terminan
+    double pairTime(int i, int j) const
+    {
+        double dx = xAt(j, now) - xAt(i, now);
+        double dy = yAt(j, now) - yAt(i, now);
+        double dvx = xVel[j] - xVel[i];
+        double dvy = yVel[j] - yVel[i];
+        double approach = dx * dvx + dy * dvy;
+        if (approach >= 0)
+        {
+            return INFINITY;
+        }
+        double speedSq = dvx * dvx + dvy * dvy;
+        double reach = radius[i] + radius[j];
+        double distanceSq = dx * dx + dy * dy;
+        if (distanceSq < (reach - 1) * (reach - 1))
+        {
+            return INFINITY;
+        }
+        double discriminant = approach * approach - speedSq * (distanceSq - reach * reach);
+        if (discriminant < 0)
+        {
+            return INFINITY;
+        }
+        return std::max(-(approach + sqrt(discriminant)) / speedSq, 0.0);
+    }
+
+    // Agrega los próximos eventos de i, que ya está en el instante actual. El
+    // recorrido de los pares es lineal en las entidades activas y se reparte
+    // entre los hilos cuando alcanza para pagar el equipo
+    void predict(int i)
+    {
+        double toX = borderTime(x[i], xVel[i], radius[i], SCREEN_WIDTH - radius[i]);
+        double toY = borderTime(y[i], yVel[i], radius[i], SCREEN_HEIGHT - radius[i]);
+        wallTime[i] = now + std::min(toX, toY);
+        if (std::isfinite(wallTime[i]))
+        {
+            push(KineticEvent{wallTime[i], i, -1, version[i], 0, toX <= toY ? KINETIC_WALL_X : KINETIC_WALL_Y});
+        }
+
+        #pragma omp parallel num_threads(found.size()) if (active >= serialThreshold)
+        {
+            std::vector<KineticEvent> &mine = found[omp_get_thread_num()];
+            #pragma omp for schedule(static) nowait
+            for (int j = 0; j < active; ++j)
+            {
+                if (j == i)
+                {
+                    continue;
+                }
+                double time = now + pairTime(i, j);
+                if (std::isfinite(time) && time <= std::min(wallTime[i], wallTime[j]))
+                {
+                    int a = std::min(i, j), b = std::max(i, j);
+                    mine.push_back(KineticEvent{time, a, b, version[a], version[b], KINETIC_PAIR});
+                }
+            }
+        }
+        for (std::vector<KineticEvent> &list : found)
+        {
+            for (const KineticEvent &event : list)
+            {
+                push(event);
+            }
+            list.clear();
+        }
+    }
+};
+
+// Una escena: sus arreglos de entidades y todo el estado de simulación que
+// persiste entre frames. Identificador global: los Pacman ocupan
+// [0, pacmans.size()) y los fantasmas siguen a continuación, en el orden en que
+// los activa la rampa. Escenas distintas no comparten nada que se escriba
+template <typename P, typename G>
+struct World
+{
+    ArchetypeBuffer<P> pacmans;
+    ArchetypeBuffer<G> ghosts;
+    ContactCache contacts;
+    CollisionEvents events;
+    FlowField flow;
+    KineticState kinetic;
+    std::vector<DrawRecord> drawRecords; // Por identificador global
+    PhaseController controllers[PHASE_COUNT];
+
+    int size() const { return pacmans.size() + ghosts.size(); }
+
+    // Registros donde anotar el daño de este frame, o nullptr si el frame no
+    // los va a usar: sin pantalla, o cuando se dibuja el mapa de densidad, que
+    // repinta todo. Así el paso no arrastra un registro más por entidad
+    DrawRecord *damageRecords(int limit)
+    {
+        return drawRecords.empty() || limit >= options.heatmapCount ? nullptr : drawRecords.data();
+    }
+
+    // Llama a visit con la entidad de un identificador global, del tipo que
+    // sea. Es para los caminos fríos; los ciclos calientes recorren cada
+    // arreglo aparte
+    template <typename Visit>
+    auto with(int id, Visit visit) -> decltype(visit(pacmans[0]))
+    {
+        return id < pacmans.size() ? visit(pacmans[id]) : visit(ghosts[id - pacmans.size()]);
+    }
+
+    template <typename Visit>
+    auto with(int id, Visit visit) const -> decltype(visit(pacmans[0]))
+    {
+        return id < pacmans.size() ? visit(pacmans[id]) : visit(ghosts[id - pacmans.size()]);
+    }
+
+    // Deja el estado de simulación listo para los arreglos actuales, con
+    // buffers y candidatos para numThreads hilos
+    void resetState(int numThreads)
+    {
+        contacts.reset(pacmans.size(), size(), numThreads);
+        events.reset(numThreads);
+        if (maze.loaded())
+            flow.reset(numThreads);
+        if (options.kinetic)
+            kinetic.reset(size(), numThreads);
+        drawRecords.assign(options.batch() ? 0 : size(), DrawRecord()); // Sin pantalla no se dibuja
+        for (PhaseController &controller : controllers)
+            controller.reset(numThreads);
+        controllers[PHASE_INTEGRATION].fixedTeam = true;
+    }
+
+    void release()
+    {
+        pacmans.release();
+        ghosts.release();
+    }
+};
+
+World<Pacman, Ghost> fullWorld;
+World<CompactPacman, CompactGhost> compactWorld;
+
+// Paso dentro del laberinto: cada eje se mueve por separado y, si queda contra
+// una pared, vuelve atrás y rebota. Una entidad que un choque metió en una
+// pared primero se saca; si no se pudo, se mueve libre hasta salir
+template <typename T>
+void moveInMaze(T &entity)
+{
+    if (maze.blocked(entity.x, entity.y, entity.radius))
+    {
+        maze.pushOut(entity);
+    }
+    bool stuck = maze.blocked(entity.x, entity.y, entity.radius);
+    entity.x += entity.xVel;
+    if (!stuck && maze.blocked(entity.x, entity.y, entity.radius))
+    {
+        entity.x -= entity.xVel;
+        entity.xVel = -entity.xVel;
+    }
+    entity.y += entity.yVel;
+    if (!stuck && maze.blocked(entity.x, entity.y, entity.radius))
+    {
+        entity.y -= entity.yVel;
+        entity.yVel = -entity.yVel;
+    }
+}
+
+// Mueve y hace rebotar contra los bordes (y las paredes del laberinto) a las
+// despiertas active[first, last) de un arreglo. Se llama dentro de la región
+// paralela
+template <typename T>
+void moveEntities(ContactCache &contacts, ArchetypeBuffer<T> &entities, int base, int first, int last)
+{
+    #pragma omp for schedule(static) nowait
+    for (int k = first; k < last; ++k)
+    {
+        int i = contacts.active[k];
+        T &entity = entities[i - base];
+        if (maze.loaded())
+        {
+            moveInMaze(entity);
+        }
+        else
+        {
+            entity.x += entity.xVel;
+            entity.y += entity.yVel;
+        }
+
+        if (entity.x - entity.radius < 0)
+        {
+            entity.x = entity.radius;
+            entity.xVel = -entity.xVel;
+        }
+        else if (entity.x + entity.radius > SCREEN_WIDTH)
+        {
+            entity.x = SCREEN_WIDTH - entity.radius;
+            entity.xVel = -entity.xVel;
+        }
+
+        if (entity.y - entity.radius < 0)
+        {
+            entity.y = entity.radius;
+            entity.yVel = -entity.yVel;
+        }
+        else if (entity.y + entity.radius > SCREEN_HEIGHT)
+        {
+            entity.y = SCREEN_HEIGHT - entity.radius;
+            entity.yVel = -entity.yVel;
+        }
+
+        bool quiet = entity.xVel == 0 && entity.yVel == 0 && !contacts.touched[i];
+        contacts.quietFrames[i] = quiet ? std::min(contacts.quietFrames[i] + 1, SLEEP_FRAMES) : 0;
+        contacts.touched[i] = 0;
+    }
+}
+
+// Actualizar el estado de visibilidad
+void updateVisibility(Pacman &, Uint32)
+{
+}
+
+void updateVisibility(Ghost &ghost, Uint32 currentTime)
+{
+    if (!ghost.isVisible && currentTime - ghost.invisibleTime >= 2000) // 2000 milisegundos = 2 segundos
+    {
+        ghost.isVisible = true;
+    }
+}
+
+void updateVisibility(CompactPacman &, Uint32)
+{
+}
+
+void updateVisibility(CompactGhost &ghost, Uint32 currentTime)
+{
+    // La resta en 16 bits da bien mientras se revise antes de 65 segundos
+    if (!ghost.isVisible && static_cast<uint16_t>(currentTime - ghost.invisibleTime) >= 2000)
+    {
+        ghost.isVisible = true;
+    }
+}
+
+// Animación, visibilidad y daño de las primeras count entidades de un arreglo.
+// Sin registros (drawRecords == nullptr) el daño no se calcula
+template <typename T>
+void animateEntities(DrawRecord *drawRecords, ArchetypeBuffer<T> &entities, int base, int count, Uint32 currentTime)
+{
+    #pragma omp for schedule(static) nowait
+    for (int i = 0; i < count; ++i)
+    {
+        T &entity = entities[i];
+        animateEntity(entity);
+        updateVisibility(entity, currentTime);
+        if (drawRecords != nullptr)
+            trackDamage(entity, drawRecords[base + i]);
+    }
+}
+
+// Apunta la velocidad de una entidad en la dirección (dx, dy) conservando su
+// rapidez (al menos 1, para que una entidad quieta pueda arrancar)
+template <typename T>
+void steer(T &entity, int dx, int dy)
+{
+    if (dx == 0 && dy == 0)
+    {
+        return;
+    }
+    float speed = std::max(sqrtf(entity.xVel * entity.xVel + entity.yVel * entity.yVel), 1.0f);
+    float length = sqrt(dx * dx + dy * dy);
+    entity.xVel = std::lround(dx * speed / length);
+    entity.yVel = std::lround(dy * speed / length);
+}
+
+// La dirección de las despiertas corre en lote y en paralelo: las consultas
+// solo leen posiciones, visibilidad y el flow field, y cada entidad escribe
+// solo su velocidad. Se llama dentro de la región paralela, antes de mover
+
+// Persecución: cada Pacman va hacia el fantasma visible más cercano
+template <typename W>
+void steerPacmans(W &world)
+{
+    const ContactCache &contacts = world.contacts;
+    #pragma omp for schedule(runtime) nowait
+    for (int k = 0; k < contacts.activePacmans; ++k)
+    {
+        int id = contacts.active[k];
+        auto &pacman = world.pacmans[id];
+        Neighbor target;
+        if (queryNearest(world, pacman.x, pacman.y, 1, PURSUIT_RADIUS, QUERY_GHOSTS | QUERY_VISIBLE, &target) > 0)
+        {
+            steer(pacman, target.x - pacman.x, target.y - pacman.y);
+        }
+    }
+}
+
+// En el laberinto los fantasmas bajan por el flow field hacia los Pacman; en
+// campo abierto (--ai) huyen de los que tienen cerca
+template <typename W>
+void steerGhosts(W &world)
+{
+    const ContactCache &contacts = world.contacts;
+    int numPacmans = world.pacmans.size();
+
+    #pragma omp for schedule(runtime) nowait
+    for (size_t k = contacts.activePacmans; k < contacts.active.size(); ++k)
+    {
+        int id = contacts.active[k];
+        auto &ghost = world.ghosts[id - numPacmans];
+        if (!shownEntity(ghost))
+        {
+            continue;
+        }
+        if (maze.loaded())
+        {
+            int dx, dy;
+            if (world.flow.downhill(ghost.x, ghost.y, dx, dy))
+                steer(ghost, dx, dy);
+            continue;
+        }
+        // Se aleja de todos los Pacman cercanos, pesando más los más próximos
+        float awayX = 0, awayY = 0;
+        queryRadius(world, ghost.x, ghost.y, FLEE_RADIUS, QUERY_PACMANS, [&](const Neighbor &pacman) {
+            float weight = 1.0f / (1 + pacman.distanceSq);
+            awayX += (ghost.x - pacman.x) * weight;
+            awayY += (ghost.y - pacman.y) * weight;
+        });
+        if (awayX != 0 || awayY != 0)
+        {
+            float scale = FLEE_RADIUS / sqrt(awayX * awayX + awayY * awayY);
+            steer(ghost, std::lround(awayX * scale), std::lround(awayY * scale));
+        }
+    }
+}
+
+// Mueve y hace rebotar solo a las despiertas. La animación, la visibilidad y el
+// daño para el redibujado siguen corriendo para todas
+template <typename W>
+void integrationStep(W &world, int limit, Uint32 currentTime)
+{
+    ContactCache &contacts = world.contacts;
+    contacts.updateActive(limit);
+
+    PhaseController &controller = world.controllers[PHASE_INTEGRATION];
+    int numPacmans = world.pacmans.size();
+    int pacmanLimit = std::min(limit, numPacmans);
+    DrawRecord *records = world.damageRecords(limit);
+    double start = omp_get_wtime();
+    if (maze.loaded())
+    {
+        world.flow.sources.clear();
+        for (int i = 0; i < pacmanLimit; ++i)
+        {
+            world.flow.sources.push_back(maze.tileIndex(world.pacmans[i].x, world.pacmans[i].y));
+        }
+        world.flow.build();
+    }
+
+    #pragma omp parallel num_threads(applyPlan(controller.plan(limit)))
+    {
+        int tid = omp_get_thread_num();
+        profileBegin(tid);
+
+        if (options.steering)
+            steerPacmans(world);
+        if (options.steering || maze.loaded())
+            steerGhosts(world);
+        #pragma omp barrier
+
+        moveEntities(contacts, world.pacmans, 0, 0, contacts.activePacmans);
+        moveEntities(contacts, world.ghosts, numPacmans, contacts.activePacmans, contacts.active.size());
+        #pragma omp barrier
+
+        animateEntities(records, world.pacmans, 0, pacmanLimit, currentTime);
+        animateEntities(records, world.ghosts, numPacmans, limit - pacmanLimit, currentTime);
+
+        profileEnd(tid, PHASE_INTEGRATION);
+    }
+    controller.record(limit, omp_get_wtime() - start);
+
+    // Las que se dirigen pueden arrancar sin que nadie las toque (un fantasma
+    // que huye o que baja por el flow field, un Pacman que persigue), así que
+    // esas no se duermen
+    for (int i : contacts.active)
+    {
+        bool steered = options.steering || (maze.loaded() && i >= numPacmans);
+        if (contacts.quietFrames[i] >= SLEEP_FRAMES && !steered)
+            contacts.sleep(world, i);
+    }
+}
+
+// Copia la velocidad de la simulación cinética a la entidad, para dibujar y
+// para los checkpoints
+template <typename W>
+void storeVelocity(W &world, const KineticState &kinetic, int id)
+{
+    world.with(id, [&](auto &entity) -> void {
+        entity.xVel = kinetic.xVel[id];
+        entity.yVel = kinetic.yVel[id];
+    });
+}
+
+// Un choque en el modo cinético: el mismo contacto que en el paso fijo (el
+// Pacman se come al fantasma visible y los dos intercambian velocidades),
+// pero en el instante exacto en que se tocan, así que no hay que separarlas
+template <typename W>
+void kineticContact(W &world, int a, int b, Uint32 currentTime, CollisionStats &stats)
+{
+    KineticState &kinetic = world.kinetic;
+    int numPacmans = world.pacmans.size();
+    if (a < numPacmans && b >= numPacmans)
+    {
+        auto &ghost = world.ghosts[b - numPacmans];
+        updateVisibility(ghost, currentTime);
+        stats.ghostsEaten += eat(ghost, currentTime);
+    }
+    std::swap(kinetic.xVel[a], kinetic.xVel[b]);
+    std::swap(kinetic.yVel[a], kinetic.yVel[b]);
+    storeVelocity(world, kinetic, a);
+    storeVelocity(world, kinetic, b);
+    stats.contacts++;
+}
+
+// Procesa en orden los eventos vigentes hasta el instante until. Un grupo de
+// entidades encimadas podría rebotar sin fin en el mismo instante, así que
+// cada llamada procesa una cantidad acotada y deja el resto para el frame
+// siguiente
+template <typename W>
+void advanceKinetic(W &world, double until, Uint32 currentTime, CollisionStats &stats)
+{
+    KineticState &kinetic = world.kinetic;
+    long budget = 1024 + 64L * kinetic.active;
+    while (!kinetic.queue.empty() && kinetic.queue.front().time <= until && budget > 0)
+    {
+        KineticEvent event = kinetic.pop();
+        if (kinetic.stale(event))
+        {
+            continue;
+        }
+        budget--;
+        kinetic.now = std::max(kinetic.now, event.time);
+        kinetic.settle(event.a);
+        if (event.type == KINETIC_PAIR)
+        {
+            kinetic.settle(event.b);
+            kineticContact(world, event.a, event.b, currentTime, stats);
+            kinetic.predict(event.a);
+            kinetic.predict(event.b);
+            continue;
+        }
+        if (event.type == KINETIC_WALL_X)
+            kinetic.xVel[event.a] = -kinetic.xVel[event.a];
+        else
+            kinetic.yVel[event.a] = -kinetic.yVel[event.a];
+        storeVelocity(world, kinetic, event.a);
+        kinetic.predict(event.a);
+    }
+    kinetic.now = std::max(kinetic.now, until);
+    kinetic.compact();
+}
+
+// Paso del modo cinético hasta el frame now: los eventos pendientes, después
+// las entidades que activa la rampa (con sus posiciones y velocidades del
+// arreglo) y por último los choques inmediatos de las que entraron encimadas.
+// Sin eventos en el frame solo cuesta mirar la cabeza de la cola
+template <typename W>
+void kineticStep(W &world, int limit, double now, Uint32 currentTime)
+{
+    KineticState &kinetic = world.kinetic;
+    CollisionStats &stats = world.events.frame;
+    profileBegin(0);
+    stats = CollisionStats();
+    advanceKinetic(world, now, currentTime, stats);
+    for (int i = kinetic.active; i < limit; ++i)
+    {
+        world.with(i, [&](const auto &entity) {
+            kinetic.x[i] = entity.x;
+            kinetic.y[i] = entity.y;
+            kinetic.xVel[i] = entity.xVel;
+            kinetic.yVel[i] = entity.yVel;
+            kinetic.radius[i] = entity.radius;
+        });
+        // Los rebotes invierten una velocidad y los choques intercambian las de
+        // dos entidades, así que solo al entrar cambia la cantidad que se mueve
+        kinetic.moving += kinetic.xVel[i] != 0 || kinetic.yVel[i] != 0;
+        kinetic.since[i] = kinetic.now;
+        kinetic.active = i + 1;
+        kinetic.predict(i);
+    }
+    advanceKinetic(world, now, currentTime, stats);
+    world.events.total.contacts += stats.contacts;
+    world.events.total.ghostsEaten += stats.ghostsEaten;
+    profileEnd(0, PHASE_COLLISION);
+}
+
+// Escribe en las primeras count entidades de un arreglo su posición en el
+// instante actual. Se llama dentro de la región paralela
+template <typename T>
+void placeEntities(const KineticState &kinetic, ArchetypeBuffer<T> &entities, int base, int count)
+{
+    #pragma omp for schedule(static) nowait
+    for (int i = 0; i < count; ++i)
+    {
+        entities[i].x = std::lround(kinetic.xAt(base + i, kinetic.now));
+        entities[i].y = std::lround(kinetic.yAt(base + i, kinetic.now));
+    }
+}
+
+// Evalúa las posiciones en el tiempo de pantalla y sigue con la animación, la
+// visibilidad y el daño igual que integrationStep
+template <typename W>
+void kineticPositions(W &world, int limit, Uint32 currentTime)
+{
+    PhaseController &controller = world.controllers[PHASE_INTEGRATION];
+    int numPacmans = world.pacmans.size();
+    int pacmanLimit = std::min(limit, numPacmans);
+    DrawRecord *records = world.damageRecords(limit);
+    double start = omp_get_wtime();
+    #pragma omp parallel num_threads(applyPlan(controller.plan(limit)))
+    {
+        int tid = omp_get_thread_num();
+        profileBegin(tid);
+
+        placeEntities(world.kinetic, world.pacmans, 0, pacmanLimit);
+        placeEntities(world.kinetic, world.ghosts, numPacmans, limit - pacmanLimit);
+        #pragma omp barrier
+
+        animateEntities(records, world.pacmans, 0, pacmanLimit, currentTime);
+        animateEntities(records, world.ghosts, numPacmans, limit - pacmanLimit, currentTime);
+
+        profileEnd(tid, PHASE_INTEGRATION);
+    }
+    controller.record(limit, omp_get_wtime() - start);
+}
+
+// Estado del dibujo que persiste entre frames
+struct DrawState
+{
+    // El canvas persiste entre frames, así solo se limpian y redibujan las regiones sucias
+    SDL_Texture *canvas = nullptr;
+    bool dirtyTiles[DIRTY_ROWS][DIRTY_COLS];
+    std::vector<SDL_Rect> dirtyRects;
+    bool fullRedraw = true;
+
+    // Mapa de densidad: una acumulación por hilo (cantidad y suma de colores por
+    // pixel) que después se reduce en paralelo a una textura
+    SDL_Texture *heatmap = nullptr;
+    std::vector<std::vector<Uint32>> heat;
+    std::vector<Uint32> pixels;
+};
+
+// Dibuja las primeras count entidades de un arreglo que caen en la región
+template <typename T>
+void drawEntities(SDL_Renderer *renderer, const std::vector<DrawRecord> &drawRecords, const ArchetypeBuffer<T> &entities, int base, int count, const SDL_Rect &rect)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        if (SDL_HasIntersection(&drawRecords[base + i].drawnBounds, &rect))
+        {
+            drawEntity(renderer, entities[i]);
+        }
+    }
+}
+
+template <typename W>
+void drawDirtyRegions(SDL_Renderer *renderer, DrawState &state, const W &world, int limit)
+{
+    // Sin canvas se dibuja directo en la ventana, que no conserva nada entre
+    // frames, así que cada frame se redibuja entero
+    if (state.canvas == nullptr)
+    {
+        state.fullRedraw = true;
+    }
+    int pacmanLimit = std::min(limit, world.pacmans.size());
+    for (int row = 0; row < DIRTY_ROWS; ++row)
+    {
+        for (int col = 0; col < DIRTY_COLS; ++col)
+        {
+            state.dirtyTiles[row][col] = state.fullRedraw;
+        }
+    }
+    if (!state.fullRedraw)
+    {
+        for (int i = 0; i < limit; ++i)
+        {
+            markDirty(state.dirtyTiles, world.drawRecords[i].damage);
+        }
+    }
+    buildDirtyRects(state.dirtyTiles, state.dirtyRects);
+    if (state.dirtyRects.size() > MAX_DIRTY_RECTS)
+    {
+        state.dirtyRects.assign(1, SDL_Rect{0, 0, SCREEN_WIDTH, SCREEN_HEIGHT});
+    }
+    state.fullRedraw = false;
+
+    // Limpiar y redibujar solo lo que cae dentro de cada región sucia. Con
+    // canvas nulo el destino es la ventana
+    SDL_SetRenderTarget(renderer, state.canvas);
+    for (const SDL_Rect &rect : state.dirtyRects)
+    {
+        SDL_RenderSetClipRect(renderer, &rect);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderFillRect(renderer, &rect);
+        if (maze.loaded())
+        {
+            maze.draw(renderer, rect);
+        }
+        drawEntities(renderer, world.drawRecords, world.pacmans, 0, pacmanLimit, rect);
+        drawEntities(renderer, world.drawRecords, world.ghosts, world.pacmans.size(), limit - pacmanLimit, rect);
+    }
+    SDL_RenderSetClipRect(renderer, NULL);
+    if (state.canvas != nullptr)
+    {
+        SDL_SetRenderTarget(renderer, NULL);
+        SDL_RenderCopy(renderer, state.canvas, NULL, NULL);
+    }
+}
+
+// Suma el color de las primeras count entidades de un arreglo en el pixel de
+// su centro. Se llama dentro de la región paralela
+template <typename T>
+void splatEntities(std::vector<Uint32> &heat, const ArchetypeBuffer<T> &entities, int count)
+{
+    #pragma omp for schedule(runtime) nowait
+    for (int i = 0; i < count; ++i)
+    {
+        const T &entity = entities[i];
+        int x = std::min(std::max<int>(entity.x, 0), SCREEN_WIDTH - 1);
+        int y = std::min(std::max<int>(entity.y, 0), SCREEN_HEIGHT - 1);
+        Uint8 r, g, b;
+        pointColor(entity, r, g, b);
+        Uint32 *cell = &heat[4 * (y * SCREEN_WIDTH + x)];
+        cell[0]++;
+        cell[1] += r;
+        cell[2] += g;
+        cell[3] += b;
+    }
+}
+
+// Con demasiadas entidades cada una suma su color en el pixel de su centro y
+// el costo queda acotado por la resolución de la pantalla
+template <typename W>
+void drawHeatmap(SDL_Renderer *renderer, DrawState &state, W &world, int limit)
+{
+    const int pixelCount = SCREEN_WIDTH * SCREEN_HEIGHT;
+    if (state.heatmap == nullptr)
+    {
+        state.heatmap = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+        state.heat.assign(options.numThreads, std::vector<Uint32>(4 * pixelCount, 0));
+        state.pixels.assign(pixelCount, 0);
+    }
+
+    int pacmanLimit = std::min(limit, world.pacmans.size());
+    PhaseController &controller = world.controllers[PHASE_DRAW];
+    int threads = applyPlan(controller.plan(limit));
+    double start = omp_get_wtime();
+    Uint32 maxCount = 1;
+    #pragma omp parallel num_threads(threads) reduction(max : maxCount)
+    {
+        int tid = omp_get_thread_num();
+        profileBegin(tid);
+
+        // Cuatro canales por pixel: cantidad, r, g, b. Los buffers llegan en cero
+        std::vector<Uint32> &heat = state.heat[tid];
+        splatEntities(heat, world.pacmans, pacmanLimit);
+        splatEntities(heat, world.ghosts, limit - pacmanLimit);
+        #pragma omp barrier
+
+        // Reducción por pixel: los totales quedan en el buffer del hilo 0 y los
+        // demás se vuelven a dejar en cero para el próximo frame
+        #pragma omp for schedule(runtime)
+        for (int p = 0; p < pixelCount; ++p)
+        {
+            Uint32 *total = &state.heat[0][4 * p];
+            for (size_t t = 1; t < state.heat.size(); ++t)
+            {
+                Uint32 *cell = &state.heat[t][4 * p];
+                total[0] += cell[0];
+                total[1] += cell[1];
+                total[2] += cell[2];
+                total[3] += cell[3];
+                cell[0] = cell[1] = cell[2] = cell[3] = 0;
+            }
+            maxCount = std::max(maxCount, total[0]);
+        }
+
+        profileEnd(tid, PHASE_DRAW);
+    }
+
+    // Brillo logarítmico según la densidad, tono según el color promedio
+    float logMax = std::log1p(static_cast<float>(maxCount));
+    #pragma omp parallel for num_threads(threads) schedule(runtime)
+    for (int p = 0; p < pixelCount; ++p)
+    {
+        Uint32 *total = &state.heat[0][4 * p];
+        if (total[0] == 0)
+        {
+            bool wall = maze.loaded() && maze.wallPixel(p % SCREEN_WIDTH, p / SCREEN_WIDTH);
+            state.pixels[p] = wall ? 0xFF2121DE : 0xFF000000;
+            continue;
+        }
+        float brightness = std::min(1.0f, std::log1p(static_cast<float>(total[0])) / logMax + 0.25f);
+        Uint32 r = total[1] / total[0] * brightness;
+        Uint32 g = total[2] / total[0] * brightness;
+        Uint32 b = total[3] / total[0] * brightness;
+        state.pixels[p] = 0xFF000000 | (r << 16) | (g << 8) | b;
+        total[0] = total[1] = total[2] = total[3] = 0;
+    }
+
+    controller.record(limit, omp_get_wtime() - start);
+
+    SDL_UpdateTexture(state.heatmap, NULL, state.pixels.data(), SCREEN_WIDTH * sizeof(Uint32));
+    SDL_RenderCopy(renderer, state.heatmap, NULL, NULL);
+    state.fullRedraw = true; // Al volver al canvas hay que redibujarlo entero
+}
+
+template <typename W>
+void drawStep(SDL_Renderer *renderer, DrawState &state, W &world, int limit)
+{
+    if (limit >= options.heatmapCount)
+    {
+        drawHeatmap(renderer, state, world, limit);
+        return;
+    }
+    profileBegin(0);
+    drawDirtyRegions(renderer, state, world, limit);
+    profileEnd(0, PHASE_DRAW);
+}
+
+// Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+// Es una función del contador y la clave, sin estado compartido entre hilos
+void philox4x32(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+{
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; ++round)
+    {
+        uint64_t product0 = static_cast<uint64_t>(0xD2511F53u) * c0;
+        uint64_t product1 = static_cast<uint64_t>(0xCD9E8D57u) * c2;
+        uint32_t hi0 = product0 >> 32, lo0 = static_cast<uint32_t>(product0);
+        uint32_t hi1 = product1 >> 32, lo1 = static_cast<uint32_t>(product1);
+        c0 = hi1 ^ c1 ^ k0;
+        c1 = lo1;
+        c2 = hi0 ^ c3 ^ k1;
+        c3 = lo0;
+        k0 += 0x9E3779B9u;
+        k1 += 0xBB67AE85u;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// Números aleatorios de una entidad: clave = semilla, contador = (índice, bloque)
+struct EntityRandom
+{
+    uint32_t key[2];
+    uint32_t counter[4];
+    uint32_t block[4];
+    int used = 4;
+
+    EntityRandom(uint64_t seed, uint32_t index)
+    {
+        key[0] = static_cast<uint32_t>(seed);
+        key[1] = static_cast<uint32_t>(seed >> 32);
+        counter[0] = index;
+        counter[1] = counter[2] = counter[3] = 0;
+    }
+
+    uint32_t next()
+    {
+        if (used == 4)
+        {
+            philox4x32(counter, key, block);
+            counter[1]++;
+            used = 0;
+        }
+        return block[used++];
+    }
+};
+
+// Tiempo de simulación en milisegundos. Los timers de las entidades usan este
+// reloj, así siguen siendo válidos después de restaurar un checkpoint
+struct SimulationClock
+{
+    Uint32 base = 0;
+    Uint32 startTicks = 0;
+
+    void start(Uint32 from)
+    {
+        base = from;
+        startTicks = SDL_GetTicks();
+    }
+
+    Uint32 now() const { return base + (SDL_GetTicks() - startTicks); }
+};
+
+SimulationClock simClock;
+
+// Estado de la rampa con la que se van activando las entidades
+struct RampState
+{
+    int64_t frame = 0;  // lowLimit
+    int realLimit = 0;
+};
+
+const char CHECKPOINT_MAGIC[8] = {'P', 'G', 'S', 'C', 'K', 'P', 'T', 0};
+const uint32_t CHECKPOINT_VERSION = 2;
+
+// Cabecera de un checkpoint. Los arreglos de Pacman y de fantasmas van a
+// continuación, cada uno en su offset alineado a página, con el mismo layout
+// que en memoria
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint32_t pacmanSize;
+    uint32_t ghostSize;
+    uint64_t pacmanOffset;
+    uint64_t ghostOffset;
+    uint64_t seed;
+    int32_t numPacmans;
+    int32_t numGhosts;
+    int64_t frame;
+    int32_t realLimit;
+    uint32_t simTime;
+};
+
+size_t pageAlign(size_t offset)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    return (offset + page - 1) / page * page;
+}
+
+bool writeAll(int fd, const void *data, size_t size)
+{
+    const char *bytes = static_cast<const char *>(data);
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written <= 0)
+        {
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool writeZeros(int fd, size_t size)
+{
+    char padding[4096] = {};
+    while (size > 0)
+    {
+        size_t chunk = std::min(size, sizeof(padding));
+        if (!writeAll(fd, padding, chunk))
+        {
+            return false;
+        }
+        size -= chunk;
+    }
+    return true;
+}
+
+// Escribe el checkpoint en un temporal y lo renombra, así nunca queda uno a
+// medias. Solo usa llamadas al sistema para poder correr en el hijo de un fork
+template <typename W>
+bool writeCheckpoint(const W &world, const char *path, const char *tmpPath, const CheckpointHeader &header)
+{
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    // En 64 bits: numPacmans * pacmanSize se desborda en 32 a partir de 4 GB
+    uint64_t pacmanBytes = static_cast<uint64_t>(header.numPacmans) * header.pacmanSize;
+    bool ok = writeAll(fd, &header, sizeof(header));
+    ok = ok && writeZeros(fd, header.pacmanOffset - sizeof(header));
+    ok = ok && writeAll(fd, world.pacmans.data, pacmanBytes);
+    ok = ok && writeZeros(fd, header.ghostOffset - header.pacmanOffset - pacmanBytes);
+    ok = ok && writeAll(fd, world.ghosts.data, static_cast<uint64_t>(header.numGhosts) * header.ghostSize);
+    ok = close(fd) == 0 && ok;
+    return ok && rename(tmpPath, path) == 0;
+}
+
+// El formato de las entidades queda indicado por sus tamaños
+template <typename W>
+CheckpointHeader makeCheckpointHeader(const W &world, const RampState &ramp)
+{
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.headerSize = sizeof(header);
+    header.pacmanSize = sizeof(world.pacmans[0]);
+    header.ghostSize = sizeof(world.ghosts[0]);
+    header.pacmanOffset = pageAlign(sizeof(header));
+    header.ghostOffset = pageAlign(header.pacmanOffset + static_cast<uint64_t>(world.pacmans.size()) * header.pacmanSize);
+    header.seed = options.seed;
+    header.numPacmans = world.pacmans.size();
+    header.numGhosts = world.ghosts.size();
+    header.frame = ramp.frame;
+    header.realLimit = ramp.realLimit;
+    header.simTime = simClock.now();
+    return header;
+}
+
+template <typename W>
+bool saveCheckpoint(const W &world, const RampState &ramp)
+{
+    std::string tmpPath = options.savePath + ".tmp";
+    if (!writeCheckpoint(world, options.savePath.c_str(), tmpPath.c_str(), makeCheckpointHeader(world, ramp)))
+    {
+        std::cerr << "Could not write checkpoint " << options.savePath << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Checkpoint periódico: un hijo de fork escribe la copia congelada de la memoria
+// mientras el proceso principal sigue; la pausa es solo la del fork
+pid_t checkpointWriter = -1;
+
+template <typename W>
+void checkpointInBackground(const W &world, const RampState &ramp)
+{
+    if (checkpointWriter > 0)
+    {
+        if (waitpid(checkpointWriter, NULL, WNOHANG) == 0)
+        {
+            return; // El anterior todavía está escribiendo
+        }
+        checkpointWriter = -1;
+    }
+
+    CheckpointHeader header = makeCheckpointHeader(world, ramp);
+    std::string tmpPath = options.savePath + ".tmp";
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        _exit(writeCheckpoint(world, options.savePath.c_str(), tmpPath.c_str(), header) ? 0 : 1);
+    }
+    checkpointWriter = pid;
+}
+
+void finishBackgroundCheckpoint()
+{
+    if (checkpointWriter > 0)
+    {
+        waitpid(checkpointWriter, NULL, 0);
+        checkpointWriter = -1;
+    }
+}
+
+// Mapeo del checkpoint restaurado, que les presta la memoria a los arreglos
+void *restoredRegion = nullptr;
+size_t restoredBytes = 0;
+
+template <typename W>
+void adoptCheckpoint(W &world, const CheckpointHeader &header, void *region)
+{
+    world.pacmans.adopt(static_cast<char *>(region) + header.pacmanOffset, header.numPacmans);
+    world.ghosts.adopt(static_cast<char *>(region) + header.ghostOffset, header.numGhosts);
+}
+
+// Mapea el checkpoint y usa los arreglos del archivo directamente como
+// almacenamiento (MAP_PRIVATE: los cambios no vuelven al archivo)
+bool restoreCheckpoint(RampState &ramp)
+{
+    const std::string &path = options.restorePath;
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0)
+    {
+        std::cerr << "Could not open checkpoint " << path << ": " << std::strerror(errno) << std::endl;
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    size_t size = info.st_size;
+    void *region = size >= sizeof(CheckpointHeader) ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (region == MAP_FAILED)
+    {
+        std::cerr << "Could not map checkpoint " << path << std::endl;
+        return false;
+    }
+
+    // El formato de las entidades sale de sus tamaños; el checkpoint se restaura
+    // con el mismo formato con el que se guardó
+    const CheckpointHeader &header = *static_cast<const CheckpointHeader *>(region);
+    bool full = header.pacmanSize == sizeof(Pacman) && header.ghostSize == sizeof(Ghost);
+    bool compact = header.pacmanSize == sizeof(CompactPacman) && header.ghostSize == sizeof(CompactGhost);
+    size_t page = sysconf(_SC_PAGESIZE);
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 || header.version != CHECKPOINT_VERSION ||
+        header.headerSize != sizeof(CheckpointHeader) || !(full || compact) ||
+        header.numPacmans < 0 || header.numGhosts < 0 || header.pacmanOffset % page != 0 || header.ghostOffset % page != 0 ||
+        header.ghostOffset > size || header.pacmanOffset > header.ghostOffset ||
+        static_cast<uint64_t>(header.numPacmans) * header.pacmanSize > header.ghostOffset - header.pacmanOffset ||
+        static_cast<uint64_t>(header.numGhosts) * header.ghostSize > size - header.ghostOffset)
+    {
+        std::cerr << "Checkpoint " << path << " is not a compatible version " << CHECKPOINT_VERSION << " checkpoint" << std::endl;
+        munmap(region, size);
+        return false;
+    }
+
+    options.seed = header.seed;
+    options.numPacmans = header.numPacmans;
+    options.numGhosts = header.numGhosts;
+    ramp.frame = header.frame;
+    ramp.realLimit = header.realLimit;
+    simClock.start(header.simTime);
+    restoredRegion = region;
+    restoredBytes = size;
+    options.compact = compact;
+    if (compact)
+        adoptCheckpoint(compactWorld, header, region);
+    else
+        adoptCheckpoint(fullWorld, header, region);
+    return true;
+}
+
+// Publica los contadores de cada frame en memoria compartida. Al ciclo
+// principal le cuesta solo unas pocas escrituras por frame
+struct TelemetryPublisher
+{
+    TelemetrySegment *segment = nullptr;
+    TelemetrySnapshot snapshot;
+
+    bool open(const std::string &name)
+    {
+        int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+        if (fd < 0 || ftruncate(fd, sizeof(TelemetrySegment)) != 0)
+        {
+            std::cerr << "Could not create telemetry segment " << name << ": " << std::strerror(errno) << std::endl;
+            if (fd >= 0)
+                ::close(fd);
+            return false;
+        }
+        void *memory = mmap(NULL, sizeof(TelemetrySegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (memory == MAP_FAILED)
+        {
+            return false;
+        }
+        segment = static_cast<TelemetrySegment *>(memory);
+        std::memset(&snapshot, 0, sizeof(snapshot));
+        segment->sequence.store(0, std::memory_order_relaxed);
+        telemetryWrite(segment, snapshot);
+        segment->writerPid = getpid();
+        segment->version = TELEMETRY_VERSION;
+        segment->magic = TELEMETRY_MAGIC;
+        return true;
+    }
+
+    template <typename W>
+    void publish(const W &world, int64_t frame, Uint32 simTime, int limit, const double phaseSeconds[PHASE_COUNT], const int phaseThreads[PHASE_COUNT])
+    {
+        if (segment == nullptr)
+        {
+            return;
+        }
+        double frameSeconds = 0, threadSeconds = 0;
+        for (int phase = 0; phase < PHASE_COUNT; ++phase)
+        {
+            snapshot.phaseMs[phase] = phaseSeconds[phase] * 1000;
+            snapshot.phaseThreads[phase] = phaseThreads[phase];
+            frameSeconds += phaseSeconds[phase];
+            threadSeconds += phaseSeconds[phase] * phaseThreads[phase];
+        }
+        snapshot.frame = frame;
+        snapshot.simTime = simTime;
+        snapshot.entities = limit;
+        // En el modo cinético nada se duerme: cuentan las que se mueven, y los
+        // pares vigentes en la cola se recuentan solo cada tanto
+        snapshot.awake = options.kinetic ? world.kinetic.moving : world.contacts.active.size();
+        if (!options.kinetic)
+            snapshot.nearPairs = world.contacts.pairCount();
+        else if (frame % KINETIC_PAIRS_EVERY == 0)
+            snapshot.nearPairs = world.kinetic.pendingPairs();
+        snapshot.contacts = world.events.frame.contacts;
+        snapshot.ghostsEaten += world.events.frame.ghostsEaten;
+        snapshot.maxThreads = options.numThreads;
+        snapshot.threadUtilization = frameSeconds > 0 ? threadSeconds / (frameSeconds * options.numThreads) : 0;
+        telemetryWrite(segment, snapshot);
+    }
+
+    void close(const std::string &name)
+    {
+        if (segment != nullptr)
+        {
+            munmap(segment, sizeof(TelemetrySegment));
+            shm_unlink(name.c_str());
+            segment = nullptr;
+        }
+    }
+};
+
+TelemetryPublisher telemetry;
+
+// Genera la escena. Cada entidad sale de su propio flujo (semilla, identificador
+// global), así la escena es la misma con cualquier cantidad de hilos. El reparto
+// estático es el de la integración sobre el umbral serial (equipo completo, ver
+// PhaseController::fixedTeam): una vez que la rampa activó todas las entidades
+// y mientras estén despiertas, cada hilo procesa el bloque de cada arreglo que
+// tocó primero. Por debajo del umbral la integración es serial. En el formato
+// compacto se genera la misma escena y se empaqueta
+template <typename W>
+bool generateEntities(W &world, int numEntities, int numGhosts, uint64_t seed)
+{
+    if (!world.pacmans.allocate(numEntities) || !world.ghosts.allocate(numGhosts))
+    {
+        std::cerr << "Could not allocate " << numEntities + numGhosts << " entities" << std::endl;
+        return false;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < numEntities; ++i)
+    {
+        EntityRandom random(seed, i);
+        Pacman p{};
+        p.radius = random.next() % 20 + 10;
+        p.x = random.next() % (SCREEN_WIDTH - 2 * p.radius) + p.radius;
+        p.y = random.next() % (SCREEN_HEIGHT - 2 * p.radius) + p.radius;
+        if (maze.loaded())
+            maze.place(random, p.radius, p.x, p.y);
+        p.xVel = random.next() % 5 + 1;
+        p.yVel = random.next() % 5 + 1;
+        p.mouthOpen = 0.1;
+        p.mouthClosing = true;
+        pack(p, world.pacmans[i]);
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < numGhosts; ++i)
+    {
+        EntityRandom random(seed, numEntities + i);
+        Ghost g{};
+        g.radius = random.next() % 20 + 10;
+        g.x = random.next() % (SCREEN_WIDTH - 2 * g.radius) + g.radius;
+        g.y = random.next() % (SCREEN_HEIGHT - 2 * g.radius) + g.radius;
+        if (maze.loaded())
+            maze.place(random, g.radius, g.x, g.y);
+        g.xVel = random.next() % 2;
+        g.yVel = random.next() % 2;
+        g.r = random.next() % 256;
+        g.g = random.next() % 256;
+        g.b = random.next() % 256;
+
+        g.eyeOffset = 0;
+        g.eyeMovingRight = true;
+        g.isVisible = true;
+        g.invisibleTime = 0;
+        pack(g, world.ghosts[i]);
+    }
+    return true;
+}
+
+bool init(int numEntities, int numGhosts, RampState &ramp)
+{
+    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    {
+        std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
+        return false;
+    }
+
+    if (!options.restorePath.empty())
+    {
+        if (!restoreCheckpoint(ramp))
+            return false;
+    }
+    else
+    {
+        simClock.start(0);
+        bool generated = options.compact ? generateEntities(compactWorld, numEntities, numGhosts, options.seed)
+                                         : generateEntities(fullWorld, numEntities, numGhosts, options.seed);
+        if (!generated)
+            return false;
+    }
+    return true;
+}
+
+void close()
+{
+    fullWorld.release();
+    compactWorld.release();
+    if (restoredRegion != nullptr)
+    {
+        munmap(restoredRegion, restoredBytes);
+        restoredRegion = nullptr;
+    }
+    SDL_Quit();
+}
+
+bool parseArgs(int argc, char *args[])
+{
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = args[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--threads" && hasValue)
+        {
+            options.numThreads = std::atoi(args[++i]);
+            if (options.numThreads <= 0)
+                return false;
+        }
+        else if (arg == "--pin" && hasValue)
+        {
+            std::string policy = args[++i];
+            if (policy == "none")
+                options.pin = PIN_NONE;
+            else if (policy == "compact")
+                options.pin = PIN_COMPACT;
+            else if (policy == "scatter")
+                options.pin = PIN_SCATTER;
+            else if (parseCpuList(policy, options.pinCpus))
+                options.pin = PIN_LIST;
+            else
+                return false;
+        }
+        else if (arg == "--seed" && hasValue)
+        {
+            options.seed = std::strtoull(args[++i], NULL, 10);
+            options.hasSeed = true;
+        }
+        else if (arg == "--lod-radius" && hasValue)
+        {
+            options.lodRadius = std::atoi(args[++i]);
+        }
+        else if (arg == "--heatmap-count" && hasValue)
+        {
+            options.heatmapCount = std::atoi(args[++i]);
+        }
+        else if (arg == "--save" && hasValue)
+        {
+            options.savePath = args[++i];
+        }
+        else if (arg == "--restore" && hasValue)
+        {
+            options.restorePath = args[++i];
+        }
+        else if (arg == "--checkpoint-every" && hasValue)
+        {
+            options.checkpointEvery = std::atoi(args[++i]);
+        }
+        else if (arg == "--no-adaptive")
+        {
+            options.adaptive = false;
+        }
+        else if (arg == "--telemetry" && hasValue)
+        {
+            options.telemetryName = args[++i];
+            if (options.telemetryName[0] != '/')
+                options.telemetryName = "/" + options.telemetryName;
+        }
+        else if (arg == "--compact")
+        {
+            options.compact = true;
+        }
+        else if (arg == "--ai")
+        {
+            options.steering = true;
+        }
+        else if (arg == "--maze" && hasValue)
+        {
+            options.mazePath = args[++i];
+        }
+        else if (arg == "--batch" && hasValue)
+        {
+            std::string value = args[++i];
+            if (value.find_first_not_of("0123456789") == std::string::npos)
+            {
+                options.batchCount = std::atoi(value.c_str());
+                if (options.batchCount <= 0)
+                    return false;
+            }
+            else
+            {
+                options.batchPath = value;
+            }
+        }
+        else if (arg == "--frames" && hasValue)
+        {
+            options.batchFrames = std::atoi(args[++i]);
+            if (options.batchFrames <= 0)
+                return false;
+        }
+        else if (arg == "--kinetic")
+        {
+            options.kinetic = true;
+        }
+        else if (arg == "--perf")
+        {
+            options.perf = true;
+        }
+        else if (arg.rfind("--", 0) == 0)
+        {
+            return false;
+        }
+        else
+        {
+            positional.push_back(arg);
+        }
+    }
+
+    // Al restaurar, las cantidades vienen del checkpoint, y en un lote leído de
+    // un archivo vienen del archivo
+    if (positional.size() == 2)
+    {
+        options.numPacmans = std::atoi(positional[0].c_str());
+        options.numGhosts = std::atoi(positional[1].c_str());
+    }
+    else if (!positional.empty() || (options.restorePath.empty() && options.batchPath.empty()))
+    {
+        return false;
+    }
+    if (options.checkpointEvery > 0 && options.savePath.empty())
+    {
+        return false;
+    }
+    // El modo cinético necesita velocidades constantes entre choques, sin
+    // dirección ni paredes de tiles
+    if (options.kinetic && (options.steering || !options.mazePath.empty()))
+    {
+        return false;
+    }
+    // El modo por lotes no tiene ventana, checkpoints ni telemetría
+    if (options.batch() && (!options.savePath.empty() || !options.restorePath.empty() || !options.telemetryName.empty() || options.perf))
+    {
+        return false;
+    }
+    if (options.numThreads == 0)
+    {
+        options.numThreads = omp_get_max_threads();
+    }
+    if (!options.hasSeed)
+    {
+        options.seed = time(NULL);
+    }
+    return true;
+}
+
+// Ciclo principal con el formato de entidades elegido
+template <typename W>
+int run(W &world, RampState &ramp)
+{
+    world.resetState(options.numThreads);
+    if (!options.telemetryName.empty() && !telemetry.open(options.telemetryName))
+    {
+        return 1;
+    }
+
+    SDL_Window *window = SDL_CreateWindow("Pacman and Ghosts Screensaver", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_SHOWN);
+    SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
+
+    DrawState drawState;
+    drawState.canvas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, SCREEN_WIDTH, SCREEN_HEIGHT);
+    if (drawState.canvas == nullptr)
+    {
+        std::cerr << "Could not create the canvas texture (" << SDL_GetError() << "), redrawing every frame" << std::endl;
+    }
+
+    bool quit = false;
+    SDL_Event e;
+
+    Uint32 startTime = SDL_GetTicks();
+    Uint32 frameCount = 0;
+
+
+
+    while (!quit)
+    {
+        ramp.frame++;
+        if (ramp.frame % 100 == 0)
+        {
+            ramp.realLimit++;
+        }
+        while (SDL_PollEvent(&e) != 0)
+        {
+            if (e.type == SDL_QUIT)
+            {
+                quit = true;
+            }
+            // Si se perdió el contenido del canvas o de la ventana hay que redibujar todo
+            if (e.type == SDL_RENDER_TARGETS_RESET || e.type == SDL_RENDER_DEVICE_RESET ||
+                (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_EXPOSED))
+            {
+                drawState.fullRedraw = true;
+            }
+        }
+        int limit = std::min(ramp.realLimit, world.size()); // Obtén el menor entre 10 y el tamaño del vector
+
+        Uint32 currentTime = simClock.now();
+
+        double phaseSeconds[PHASE_COUNT];
+        double phaseStart = omp_get_wtime();
+
+        // Handle collisions
+        if (options.kinetic)
+            kineticStep(world, limit, ramp.frame, currentTime);
+        else
+            collisionStep(world, limit, currentTime);
+        phaseSeconds[PHASE_COLLISION] = omp_get_wtime() - phaseStart;
+
+        // Movimiento, rebotes, animación y registro del daño para el redibujado
+        phaseStart = omp_get_wtime();
+        if (options.kinetic)
+            kineticPositions(world, limit, currentTime);
+        else
+            integrationStep(world, limit, currentTime);
+        phaseSeconds[PHASE_INTEGRATION] = omp_get_wtime() - phaseStart;
+
+        phaseStart = omp_get_wtime();
+        drawStep(renderer, drawState, world, limit);
+        phaseSeconds[PHASE_DRAW] = omp_get_wtime() - phaseStart;
+
+        phaseStart = omp_get_wtime();
+        profileBegin(0);
         SDL_RenderPresent(renderer);
+        profileEnd(0, PHASE_PRESENT);
+        phaseSeconds[PHASE_PRESENT] = omp_get_wtime() - phaseStart;
+
+        int phaseThreads[PHASE_COUNT] = {
+            world.controllers[PHASE_COLLISION].lastThreads,
+            world.controllers[PHASE_INTEGRATION].lastThreads,
+            limit >= options.heatmapCount ? world.controllers[PHASE_DRAW].lastThreads : 1,
+            1,
+        };
+        telemetry.publish(world, ramp.frame, currentTime, limit, phaseSeconds, phaseThreads);
+
+        if (options.checkpointEvery > 0 && ramp.frame % options.checkpointEvery == 0)
+        {
+            checkpointInBackground(world, ramp);
+        }
 
         frameCount++;
         if (SDL_GetTicks() - startTime >= 1000) {  // Si ha pasado un segundo
-            std::cout << "FPS: " << frameCount << std::endl;
+            CollisionStats &stats = world.events.total;
+            double contactsPerFrame = static_cast<double>(stats.contacts) / std::max<Uint32>(frameCount, 1);
+            std::cout << "FPS: " << frameCount << " contacts/frame: " << std::fixed << std::setprecision(1) << contactsPerFrame
+                      << " ghosts eaten/s: " << stats.ghostsEaten << std::endl;
+            stats = CollisionStats();
             frameCount = 0;
             startTime = SDL_GetTicks();
         }
     }
 
+    reportProfiling();
+    telemetry.close(options.telemetryName);
+
+    finishBackgroundCheckpoint();
+    if (!options.savePath.empty())
+    {
+        saveCheckpoint(world, ramp);
+    }
+
+    if (drawState.heatmap != nullptr)
+    {
+        SDL_DestroyTexture(drawState.heatmap);
+    }
+    if (drawState.canvas != nullptr)
+    {
+        SDL_DestroyTexture(drawState.canvas);
+    }
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
-    close();
 
     return 0;
 }
+
+// Modo por lotes (--batch): muchas escenas independientes en un solo proceso,
+// sin SDL ni ventana, para estudios de parámetros. Cada escena es un World con
+// su propio estado y la simula de punta a punta un solo hilo, que además toca
+// primero sus arreglos. Las escenas se reparten dinámicamente de a una, así las
+// chicas se acomodan en los hilos que van quedando libres. Todas las entidades
+// están activas desde el primer paso y el reloj avanza un paso fijo por frame
+const Uint32 BATCH_FRAME_MS = 16;
+
+struct BatchScene
+{
+    int numPacmans;
+    int numGhosts;
+    uint64_t seed;
+};
+
+struct BatchResult
+{
+    CollisionStats stats;
+    int awake = 0;
+    int thread = -1;
+    double seconds = 0;
+};
+
+// N copias de las cantidades de la línea de comandos con semillas seed, seed + 1,
+// ... o un archivo con líneas "numPacmans numGhosts [seed]"
+bool readBatchScenes(std::vector<BatchScene> &scenes)
+{
+    scenes.clear();
+    if (options.batchPath.empty())
+    {
+        for (int i = 0; i < options.batchCount; ++i)
+        {
+            scenes.push_back(BatchScene{options.numPacmans, options.numGhosts, options.seed + i});
+        }
+        return true;
+    }
+
+    std::ifstream file(options.batchPath);
+    if (!file)
+    {
+        std::cerr << "Could not open batch file " << options.batchPath << std::endl;
+        return false;
+    }
+    std::string line;
+    for (int number = 1; std::getline(file, line); ++number)
+    {
+        std::istringstream fields(line);
+        BatchScene scene{0, 0, options.seed + scenes.size()};
+        std::string first;
+        if (!(fields >> first) || first[0] == '#')
+        {
+            continue;
+        }
+        scene.numPacmans = std::atoi(first.c_str());
+        if (!(fields >> scene.numGhosts) || scene.numPacmans < 0 || scene.numGhosts < 0)
+        {
+            std::cerr << options.batchPath << ":" << number << ": expected numPacmans numGhosts [seed]" << std::endl;
+            return false;
+        }
+        fields >> scene.seed;
+        scenes.push_back(scene);
+    }
+    if (scenes.empty())
+    {
+        std::cerr << "Batch file " << options.batchPath << " has no scenes" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+template <typename W>
+bool simulateScene(const BatchScene &scene, BatchResult &result)
+{
+    W world;
+    if (!generateEntities(world, scene.numPacmans, scene.numGhosts, scene.seed))
+    {
+        return false;
+    }
+    world.resetState(1);
+    int limit = world.size();
+    double start = omp_get_wtime();
+    for (int frame = 0; frame < options.batchFrames; ++frame)
+    {
+        Uint32 currentTime = frame * BATCH_FRAME_MS;
+        if (options.kinetic)
+        {
+            // Sin pantalla no hace falta evaluar las posiciones en cada paso
+            kineticStep(world, limit, frame, currentTime);
+            continue;
+        }
+        collisionStep(world, limit, currentTime);
+        integrationStep(world, limit, currentTime);
+    }
+    if (options.kinetic)
+    {
+        kineticPositions(world, limit, options.batchFrames * BATCH_FRAME_MS);
+    }
+    result.seconds = omp_get_wtime() - start;
+    result.stats = world.events.total;
+    result.awake = options.kinetic ? world.kinetic.moving : world.contacts.active.size();
+    world.release();
+    return true;
+}
+
+template <typename W>
+int runBatch(const std::vector<BatchScene> &scenes)
+{
+    // Las más grandes primero, así las más chicas rellenan el final
+    std::vector<int> order;
+    for (size_t i = 0; i < scenes.size(); ++i)
+    {
+        order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return scenes[a].numPacmans + scenes[a].numGhosts > scenes[b].numPacmans + scenes[b].numGhosts;
+    });
+
+    // Las regiones paralelas de cada paso quedan anidadas y corren con un solo hilo
+    omp_set_max_active_levels(1);
+    std::vector<BatchResult> results(scenes.size());
+    int failed = 0;
+    double start = omp_get_wtime();
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(options.numThreads) reduction(+ : failed)
+    for (size_t k = 0; k < order.size(); ++k)
+    {
+        BatchResult &result = results[order[k]];
+        result.thread = omp_get_thread_num();
+        failed += !simulateScene<W>(scenes[order[k]], result);
+    }
+    double wall = omp_get_wtime() - start;
+
+    std::cout << std::left << std::setw(7) << "scene" << std::right << std::setw(9) << "pacmans" << std::setw(9) << "ghosts"
+              << std::setw(22) << "seed" << std::setw(8) << "thread" << std::setw(12) << "contacts" << std::setw(10) << "eaten"
+              << std::setw(9) << "awake" << std::setw(11) << "seconds" << std::setw(12) << "steps/s" << std::endl;
+    double busy = 0, entitySteps = 0;
+    for (size_t i = 0; i < scenes.size(); ++i)
+    {
+        const BatchScene &scene = scenes[i];
+        const BatchResult &result = results[i];
+        busy += result.seconds;
+        entitySteps += static_cast<double>(scene.numPacmans + scene.numGhosts) * options.batchFrames;
+        std::cout << std::left << std::setw(7) << i << std::right << std::setw(9) << scene.numPacmans << std::setw(9)
+                  << scene.numGhosts << std::setw(22) << scene.seed << std::setw(8) << result.thread << std::setw(12)
+                  << result.stats.contacts << std::setw(10) << result.stats.ghostsEaten << std::setw(9) << result.awake
+                  << std::fixed << std::setprecision(3) << std::setw(11) << result.seconds << std::setprecision(0)
+                  << std::setw(12) << (result.seconds > 0 ? options.batchFrames / result.seconds : 0) << std::endl;
+    }
+    std::cout << std::fixed << std::setprecision(3) << "Batch: " << scenes.size() << " scenes x " << options.batchFrames
+              << " steps in " << wall << " s, " << std::setprecision(0) << scenes.size() * options.batchFrames / wall
+              << " steps/s, " << entitySteps / wall << " entity-steps/s, " << std::setprecision(2) << busy / wall
+              << " threads busy" << std::endl;
+    return failed > 0 ? 1 : 0;
+}
+
+int main(int argc, char *args[])
+{
+    if (!parseArgs(argc, args))
+    {
+        std::cerr << "Usage: " << args[0] << " <numPacmans> <numGhosts> [--threads N] [--pin none|compact|scatter|<cpulist>] [--perf] [--seed N] [--lod-radius R] [--heatmap-count N] [--save FILE [--checkpoint-every N]] [--restore FILE] [--no-adaptive] [--telemetry NAME] [--compact] [--ai] [--maze FILE] [--batch N|FILE [--frames N]] [--kinetic]" << std::endl;
+        return 1;
+    }
+
+    // Los hilos se fijan antes de reservar las entidades para que el primer toque
+    // ya ocurra desde la CPU definitiva de cada hilo
+    setupThreads();
+    setupProfiling();
+    calibrateSerialThreshold();
+    if (!options.mazePath.empty() && !maze.load(options.mazePath))
+    {
+        return 1;
+    }
+
+    if (options.batch())
+    {
+        std::vector<BatchScene> scenes;
+        if (!readBatchScenes(scenes))
+        {
+            return 1;
+        }
+        return options.compact ? runBatch<World<CompactPacman, CompactGhost>>(scenes)
+                               : runBatch<World<Pacman, Ghost>>(scenes);
+    }
+
+    RampState ramp;
+    if (!init(options.numPacmans, options.numGhosts, ramp))
+    {
+        return 1;
+    }
+    std::cout << "Seed: " << options.seed << (options.compact ? " (compact entities)" : "") << std::endl;
+
+    int status = options.compact ? run(compactWorld, ramp) : run(fullWorld, ramp);
+    close();
+
+    return status;
+}
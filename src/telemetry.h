@@ -0,0 +1,80 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+// Segmento de memoria compartida (POSIX shm) donde la versión paralela publica
+// sus contadores en vivo. Lo comparten screensaverparalel.cpp y telemetryreader.cpp
+
+const char TELEMETRY_DEFAULT_NAME[] = "/pacman_screensaver";
+const uint32_t TELEMETRY_MAGIC = 0x4c544d50; // "PMTL"
+const uint32_t TELEMETRY_VERSION = 1;
+
+// Mismo orden que las fases del ciclo principal
+enum TelemetryPhase
+{
+    TELEMETRY_COLLISION,
+    TELEMETRY_INTEGRATION,
+    TELEMETRY_DRAW,
+    TELEMETRY_PRESENT,
+    TELEMETRY_PHASES
+};
+
+struct TelemetrySnapshot
+{
+    uint64_t frame;
+    uint32_t simTime;                        // Milisegundos de simulación
+    uint32_t entities;                       // Entidades activadas por la rampa
+    uint32_t awake;                          // Entidades que no están dormidas (--kinetic: las que se mueven)
+    uint32_t nearPairs;                      // Pares en la caché de contactos (--kinetic: pares en la cola, cada 64 frames)
+    uint32_t contacts;                       // Contactos resueltos en el último frame
+    uint32_t maxThreads;
+    uint64_t ghostsEaten;                    // Total desde el arranque
+    double phaseMs[TELEMETRY_PHASES];        // Duración de cada fase en el último frame
+    uint32_t phaseThreads[TELEMETRY_PHASES]; // Hilos que usó cada fase
+    double threadUtilization;                // Hilos-tiempo usados / (maxThreads * tiempo del frame)
+};
+
+// Seqlock: el escritor deja la secuencia impar mientras escribe y par al
+// terminar; el lector reintenta si la vio impar o si cambió durante la copia
+struct TelemetrySegment
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t writerPid;
+    std::atomic<uint32_t> sequence;
+    TelemetrySnapshot data;
+};
+
+inline void telemetryWrite(TelemetrySegment *segment, const TelemetrySnapshot &snapshot)
+{
+    uint32_t sequence = segment->sequence.load(std::memory_order_relaxed);
+    segment->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&segment->data, &snapshot, sizeof(snapshot));
+    segment->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+// Devuelve false si no logró una copia consistente (el escritor no paró de escribir)
+inline bool telemetryRead(const TelemetrySegment *segment, TelemetrySnapshot &snapshot)
+{
+    for (int attempt = 0; attempt < 1000; ++attempt)
+    {
+        uint32_t before = segment->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+        {
+            continue;
+        }
+        std::memcpy(&snapshot, const_cast<const TelemetrySnapshot *>(&segment->data), sizeof(snapshot));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment->sequence.load(std::memory_order_relaxed) == before)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
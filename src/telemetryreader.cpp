@@ -0,0 +1,93 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "telemetry.h"
+
+// Lector de la telemetría en vivo de screensaverparalel (--telemetry NAME)
+
+const char *phaseLabels[TELEMETRY_PHASES] = {"collision", "integration", "draw", "present"};
+
+void printSnapshot(const TelemetrySnapshot &s)
+{
+    std::cout << std::fixed << std::setprecision(2)
+              << "frame " << s.frame << "  t " << s.simTime << " ms"
+              << "  entities " << s.entities << "  awake " << s.awake
+              << "  pairs " << s.nearPairs << "  contacts " << s.contacts
+              << "  eaten " << s.ghostsEaten << std::endl;
+    for (int phase = 0; phase < TELEMETRY_PHASES; ++phase)
+    {
+        std::cout << "  " << std::left << std::setw(12) << phaseLabels[phase] << std::right
+                  << std::setw(9) << s.phaseMs[phase] << " ms  " << s.phaseThreads[phase] << " threads" << std::endl;
+    }
+    std::cout << "  utilization " << std::setprecision(1) << s.threadUtilization * 100 << "% of "
+              << s.maxThreads << " threads" << std::endl;
+}
+
+int main(int argc, char *args[])
+{
+    std::string name = TELEMETRY_DEFAULT_NAME;
+    int intervalMs = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = args[i];
+        if (arg == "--follow")
+        {
+            intervalMs = (i + 1 < argc && args[i + 1][0] != '-') ? std::atoi(args[++i]) : 1000;
+        }
+        else if (arg[0] != '-')
+        {
+            name = arg;
+        }
+        else
+        {
+            std::cerr << "Usage: " << args[0] << " [NAME] [--follow [intervalMs]]" << std::endl;
+            return 1;
+        }
+    }
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+        std::cerr << "Could not open telemetry segment " << name << ": " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+    void *memory = mmap(NULL, sizeof(TelemetrySegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        std::cerr << "Could not map telemetry segment " << name << std::endl;
+        return 1;
+    }
+
+    const TelemetrySegment *segment = static_cast<const TelemetrySegment *>(memory);
+    if (segment->magic != TELEMETRY_MAGIC || segment->version != TELEMETRY_VERSION)
+    {
+        std::cerr << name << " is not a version " << TELEMETRY_VERSION << " telemetry segment" << std::endl;
+        return 1;
+    }
+
+    TelemetrySnapshot snapshot;
+    do
+    {
+        if (!telemetryRead(segment, snapshot))
+        {
+            std::cerr << "Could not read a consistent snapshot" << std::endl;
+            return 1;
+        }
+        printSnapshot(snapshot);
+        if (intervalMs > 0)
+        {
+            usleep(intervalMs * 1000);
+        }
+    } while (intervalMs > 0);
+
+    munmap(memory, sizeof(TelemetrySegment));
+    return 0;
+}